@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "lib/json.h"
+
+// Offsets into the mempool are 16 bits wide, so this is as large as a pool can get.
+#define MEMPOOL_SIZE 65535
+#define CORPUS_SIZE 32768
+
+// Each measurement is repeated until at least this much time has passed.
+#define MIN_SECONDS 0.2
+
+// Output is one "case,metric,value" line per measurement, so that results can be
+// diffed or loaded into a spreadsheet between releases.
+
+char mempool[MEMPOOL_SIZE];
+
+// Deterministic linear congruential generator, so every run sees the same corpus.
+unsigned int seed = 12345;
+unsigned int next_random()
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+double now()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+size_t generate_wide(char * out)
+{
+    char * c = out;
+    c += sprintf(c, "{");
+    for (int i = 0; i < 150; i++)
+    {
+        if (i > 0) c += sprintf(c, ",");
+        switch (i % 3)
+        {
+            case 0:
+                c += sprintf(c, "\"field_%03d\": %u", i, next_random());
+                break;
+            case 1:
+                c += sprintf(c, "\"field_%03d\": \"value %u\"", i, next_random());
+                break;
+            default:
+                c += sprintf(c, "\"field_%03d\": %s", i, next_random() % 2 ? "true" : "false");
+                break;
+        }
+    }
+    c += sprintf(c, "}");
+    return c - out;
+}
+
+size_t generate_deep(char * out)
+{
+    const int depth = 32;
+    char * c = out;
+    for (int i = 0; i < depth; i++)
+    {
+        c += sprintf(c, "{\"level%d\": ", i);
+    }
+    c += sprintf(c, "{\"leaf\": [1, 2, 3]}");
+    for (int i = 0; i < depth; i++)
+    {
+        c += sprintf(c, "}");
+    }
+    return c - out;
+}
+
+size_t generate_numeric(char * out)
+{
+    char * c = out;
+    c += sprintf(c, "{\"values\": [");
+    for (int i = 0; i < 800; i++)
+    {
+        if (i > 0) c += sprintf(c, ", ");
+        c += sprintf(c, "%s%u.%02u", next_random() % 4 ? "" : "-", next_random() % 10000, next_random() % 100);
+    }
+    c += sprintf(c, "]}");
+    return c - out;
+}
+
+size_t generate_logs(char * out)
+{
+    static const char * levels[] = { "info", "warn", "error", "debug" };
+    static const char * words[] = {
+        "request", "completed", "user", "session", "timeout", "retrying", "cache",
+        "miss", "upstream", "latency", "exceeded", "connection", "reset", "ok"
+    };
+
+    char * c = out;
+    c += sprintf(c, "{\"logs\": [");
+    for (int i = 0; i < 60; i++)
+    {
+        if (i > 0) c += sprintf(c, ", ");
+        c += sprintf(c, "{\"ts\": %u, \"level\": \"%s\", \"service\": \"api-%u\", \"message\": \"",
+            1500000 + i * 7, levels[next_random() % 4], next_random() % 8);
+        int nWords = 6 + next_random() % 8;
+        for (int w = 0; w < nWords; w++)
+        {
+            c += sprintf(c, w ? " %s" : "%s", words[next_random() % 14]);
+        }
+        c += sprintf(c, "\"}");
+    }
+    c += sprintf(c, "]}");
+    return c - out;
+}
+
+size_t read_file(char * filename, char * out)
+{
+    FILE * file = fopen(filename, "r");
+    assert(file);
+    size_t length = fread(out, 1, CORPUS_SIZE - 1, file);
+    fclose(file);
+    out[length] = '\0';
+    return length;
+}
+
+#ifdef JSON_PROFILE
+// Parses the document once more with fresh counters, and reports where the time went.
+void profile_document(char * name, char * input)
+{
+    JsonObject * parsed;
+    JsonProfile profile;
+    Json_reset_mempool();
+    Json_reset_profile();
+    parse_JsonObject(input, &parsed);
+    Json_get_profile(&profile);
+
+    for (int i = 0; i < JSON_PARSE_STATES; i++)
+    {
+        printf("%s,dispatches_%s,%lu\n", name, Json_parse_state_name(i), profile.dispatches[i]);
+    }
+    printf("%s,whitespace_bytes,%lu\n", name, profile.whitespace_bytes);
+    printf("%s,escapes,%lu\n", name, profile.escapes);
+    printf("%s,numbers,%lu\n", name, profile.numbers);
+    printf("%s,peak_parse_stack,%d\n", name, profile.peak_depth[0]);
+    printf("%s,peak_object_stack,%d\n", name, profile.peak_depth[1]);
+    printf("%s,peak_buffer_stack,%d\n", name, profile.peak_depth[2]);
+    printf("%s,peak_deserialize_stack,%d\n", name, profile.peak_depth[3]);
+    printf("%s,string_cycles,%llu\n", name, profile.string_cycles);
+    printf("%s,number_cycles,%llu\n", name, profile.number_cycles);
+    printf("%s,tree_cycles,%llu\n", name, profile.tree_cycles);
+}
+#endif
+
+void bench_document(char * name, char * input, size_t length)
+{
+    static char output[CORPUS_SIZE * 2];
+    JsonObject * parsed;
+
+    JsonMempoolStats stats;
+    Json_reset_mempool();
+    assert(parse_JsonObject(input, &parsed));
+    Json_get_mempool_stats(&stats);
+
+    long iterations = 0;
+    double start = now(), elapsed;
+    do
+    {
+        Json_reset_mempool();
+        parse_JsonObject(input, &parsed);
+        iterations++;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    double parseRate = length * iterations / elapsed / 1e6;
+
+    size_t dumped = 0;
+    iterations = 0;
+    start = now();
+    do
+    {
+        dumped = dump_JsonObject(parsed, output);
+        iterations++;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    double dumpRate = dumped * iterations / elapsed / 1e6;
+
+    static char parallelOutput[CORPUS_SIZE * 2];
+    iterations = 0;
+    start = now();
+    do
+    {
+        assert(dump_JsonObject_parallel(parsed, parallelOutput, 4) == dumped);
+        iterations++;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    double parallelDumpRate = dumped * iterations / elapsed / 1e6;
+    assert(strcmp(output, parallelOutput) == 0);
+
+    iterations = 0;
+    start = now();
+    do
+    {
+        Json_reset_mempool();
+        assert(parse_JsonObject_parallel(input, &parsed, NULL, 4));
+        iterations++;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    double parallelParseRate = length * iterations / elapsed / 1e6;
+    assert(dump_JsonObject(parsed, parallelOutput) == dumped);
+    assert(strcmp(output, parallelOutput) == 0);
+
+    iterations = 0;
+    start = now();
+    do
+    {
+        assert(validate_Json(input, length));
+        iterations++;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    double validateRate = length * iterations / elapsed / 1e6;
+
+    printf("%s,input_bytes,%zu\n", name, length);
+    printf("%s,parse_mb_per_s,%.2f\n", name, parseRate);
+    printf("%s,parse_4_threads_mb_per_s,%.2f\n", name, parallelParseRate);
+    printf("%s,validate_mb_per_s,%.2f\n", name, validateRate);
+    printf("%s,dump_mb_per_s,%.2f\n", name, dumpRate);
+    printf("%s,dump_4_threads_mb_per_s,%.2f\n", name, parallelDumpRate);
+    printf("%s,pool_bytes_per_input_byte,%.3f\n", name, (double) stats.last_parse_used / stats.last_parse_input);
+
+    #ifdef JSON_PROFILE
+    profile_document(name, input);
+    #endif
+}
+
+// Builds an object with `fanout` keys of `keyLength` characters, which all differ
+// in their first character, then times get_value over every key.
+void bench_get_value(int fanout, int keyLength)
+{
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    char keys[64][128];
+
+    Json_reset_mempool();
+    JsonObject * o = create_JsonObject();
+    for (int i = 0; i < fanout; i++)
+    {
+        keys[i][0] = letters[i];
+        for (int j = 1; j < keyLength; j++)
+        {
+            keys[i][j] = letters[next_random() % 26];
+        }
+        keys[i][keyLength] = '\0';
+        set_value_float(o, keys[i], i);
+    }
+
+    volatile float sink = 0;
+    long lookups = 0;
+    double start = now(), elapsed;
+    do
+    {
+        for (int i = 0; i < fanout; i++)
+        {
+            sink += get_value(o, keys[i]).data.f;
+        }
+        lookups += fanout;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+
+    printf("get_value_fanout%d_keylen%d,ns_per_lookup,%.2f\n", fanout, keyLength, elapsed * 1e9 / lookups);
+}
+
+// Reads three fields of every record in the logs document, with get_value per
+// field and element, then with export_JsonColumns.
+void bench_columns()
+{
+    static char corpus[CORPUS_SIZE];
+    generate_logs(corpus);
+    Json_reset_mempool();
+    JsonObject * parsed;
+    assert(parse_JsonObject(corpus, &parsed));
+    JsonArray * logs = get_value(parsed, "logs").data.a;
+
+    int64_t ts[64];
+    char * levels[64];
+    char * services[64];
+    u_int8_t nulls[3][8];
+    volatile int64_t sink = 0;
+
+    long rows = 0;
+    double start = now(), elapsed;
+    do
+    {
+        for (int i = 0; i < logs->length; i++)
+        {
+            JsonObject * o = get_element(logs, i).data.o;
+            sink += get_value(o, "ts").data.i;
+            levels[i] = get_value_string(o, "level");
+            services[i] = get_value_string(o, "service");
+        }
+        rows += logs->length;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    printf("columns_logs,get_value_ns_per_row,%.2f\n", elapsed * 1e9 / rows);
+
+    JsonColumn columns[] = {
+        { "ts", JSON_INT, ts, nulls[0] },
+        { "level", JSON_STRING, levels, nulls[1] },
+        { "service", JSON_STRING, services, nulls[2] },
+    };
+    rows = 0;
+    start = now();
+    do
+    {
+        export_JsonColumns(logs, columns, 3);
+        sink += ts[0];
+        rows += logs->length;
+    } while ((elapsed = now() - start) < MIN_SECONDS);
+    printf("columns_logs,export_ns_per_row,%.2f\n", elapsed * 1e9 / rows);
+}
+
+int main()
+{
+    static char corpus[CORPUS_SIZE];
+    Json_set_mempool(mempool, MEMPOOL_SIZE);
+
+    printf("case,metric,value\n");
+    bench_document("wide_object", corpus, generate_wide(corpus));
+    bench_document("deep_nesting", corpus, generate_deep(corpus));
+    bench_document("numeric_array", corpus, generate_numeric(corpus));
+    bench_document("string_logs", corpus, generate_logs(corpus));
+    bench_document("sample1", corpus, read_file("samples/sample1.json", corpus));
+    bench_document("sample2", corpus, read_file("samples/sample2.json", corpus));
+    bench_document("sample3", corpus, read_file("samples/sample3.json", corpus));
+
+    int fanouts[] = { 1, 8, 32 };
+    int keyLengths[] = { 4, 16, 64 };
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            bench_get_value(fanouts[i], keyLengths[j]);
+        }
+    }
+    bench_columns();
+
+    return 0;
+}
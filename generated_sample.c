@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "json.h"
+#include "message.h"
+
+// Exercises the code emitted by generator.c for samples/message.schema.
+int main()
+{
+    char * input = "{\"name\": \"probe\", \"unknown\": [1, {\"a\": \"}\"}], \"visible\": true, "
+                   "\"id\": 9007199254740993, \"score\": 0.1, \"origin\": {\"y\": -1.5, \"x\": 3}}";
+    Message message;
+    bool success = parse_Message(&input, &message);
+    assert(success);
+    assert(strcmp(message.name, "probe") == 0);
+    assert(message.visible);
+    // Past 2^53, so a float or double would have rounded it.
+    assert(message.id == 9007199254740993LL);
+    assert(message.score == 0.1);
+    assert(message.origin.x == 3);
+    assert(message.origin.y == -1.5);
+
+    char output[256];
+    dump_Message(&message, output);
+    printf("%s\n", output);
+    assert(strcmp(output, "{\"name\":\"probe\",\"visible\":true,\"id\":9007199254740993,\"score\":0.1,\"origin\":{\"x\":3,\"y\":-1.5}}") == 0);
+
+    return 0;
+}
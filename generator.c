@@ -0,0 +1,424 @@
+//
+//  generator.c
+//  JSON
+//
+//  Emits specialized parse/dump functions for fixed message formats, so that
+//  they can be read straight into plain C structs without building a trie.
+//
+//  Usage: generator.out <schema> <output prefix>
+//  Writes <output prefix>.h and <output prefix>.c.
+//
+//  Schema format, one declaration per line ('#' starts a comment):
+//
+//      struct Point
+//          float x
+//          float y
+//      end
+//
+//      struct Message
+//          string name 32      # char name[32]
+//          int id              # int64_t, there is also double
+//          bool visible
+//          Point origin        # structs must be declared before use
+//      end
+//
+//  Field names double as JSON keys. Unknown keys are skipped, and fields that
+//  are missing from the input are left zeroed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define MAX_NAME_LENGTH 64
+#define MAX_FIELDS 64
+#define MAX_STRUCTS 64
+
+typedef enum
+{
+    FIELD_FLOAT,
+    FIELD_INT,
+    FIELD_DOUBLE,
+    FIELD_BOOL,
+    FIELD_STRING,
+    FIELD_STRUCT
+} FieldType;
+
+typedef struct Field
+{
+    FieldType type;
+    char name[MAX_NAME_LENGTH];
+    char struct_name[MAX_NAME_LENGTH];
+    int length;
+} Field;
+
+typedef struct Struct
+{
+    char name[MAX_NAME_LENGTH];
+    Field fields[MAX_FIELDS];
+    int nFields;
+} Struct;
+
+Struct structs[MAX_STRUCTS];
+int nStructs = 0;
+
+bool is_declared(char * name)
+{
+    for (int i = 0; i < nStructs; i++)
+    {
+        if (strcmp(structs[i].name, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool read_schema(FILE * file)
+{
+    char line[256];
+    Struct * current = NULL;
+    int lineNumber = 0;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+        char * comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char first[MAX_NAME_LENGTH], second[MAX_NAME_LENGTH];
+        int length = 0;
+        int nTokens = sscanf(line, "%63s %63s %d", first, second, &length);
+        if (nTokens <= 0)
+        {
+            continue;
+        }
+
+        if (!current)
+        {
+            if (nTokens != 2 || strcmp(first, "struct") != 0 || nStructs == MAX_STRUCTS)
+            {
+                fprintf(stderr, "%d: expected 'struct <name>'\n", lineNumber);
+                return false;
+            }
+            current = &structs[nStructs];
+            strcpy(current->name, second);
+            current->nFields = 0;
+            continue;
+        }
+
+        if (strcmp(first, "end") == 0)
+        {
+            nStructs++;
+            current = NULL;
+            continue;
+        }
+
+        if (nTokens < 2 || current->nFields == MAX_FIELDS)
+        {
+            fprintf(stderr, "%d: expected '<type> <name>'\n", lineNumber);
+            return false;
+        }
+
+        Field * field = &current->fields[current->nFields++];
+        strcpy(field->name, second);
+        if (strcmp(first, "float") == 0)
+        {
+            field->type = FIELD_FLOAT;
+        }
+        else if (strcmp(first, "int") == 0)
+        {
+            field->type = FIELD_INT;
+        }
+        else if (strcmp(first, "double") == 0)
+        {
+            field->type = FIELD_DOUBLE;
+        }
+        else if (strcmp(first, "bool") == 0)
+        {
+            field->type = FIELD_BOOL;
+        }
+        else if (strcmp(first, "string") == 0)
+        {
+            if (nTokens != 3 || length < 1)
+            {
+                fprintf(stderr, "%d: expected 'string <name> <length>'\n", lineNumber);
+                return false;
+            }
+            field->type = FIELD_STRING;
+            field->length = length;
+        }
+        else if (is_declared(first))
+        {
+            field->type = FIELD_STRUCT;
+            strcpy(field->struct_name, first);
+        }
+        else
+        {
+            fprintf(stderr, "%d: unknown type '%s'\n", lineNumber, first);
+            return false;
+        }
+    }
+
+    if (current)
+    {
+        fprintf(stderr, "%d: missing 'end'\n", lineNumber);
+        return false;
+    }
+
+    return true;
+}
+
+void write_header(FILE * out, char * guard)
+{
+    fprintf(out, "// Generated by generator.c. Do not edit.\n\n");
+    fprintf(out, "#ifndef %s\n#define %s\n\n", guard, guard);
+    fprintf(out, "#include <stdlib.h>\n#include <stdbool.h>\n#include <stdint.h>\n\n");
+
+    for (int i = 0; i < nStructs; i++)
+    {
+        Struct * s = &structs[i];
+        fprintf(out, "typedef struct %s\n{\n", s->name);
+        for (int j = 0; j < s->nFields; j++)
+        {
+            Field * f = &s->fields[j];
+            switch (f->type)
+            {
+                case FIELD_FLOAT:
+                    fprintf(out, "    float %s;\n", f->name);
+                    break;
+                case FIELD_INT:
+                    fprintf(out, "    int64_t %s;\n", f->name);
+                    break;
+                case FIELD_DOUBLE:
+                    fprintf(out, "    double %s;\n", f->name);
+                    break;
+                case FIELD_BOOL:
+                    fprintf(out, "    bool %s;\n", f->name);
+                    break;
+                case FIELD_STRING:
+                    fprintf(out, "    char %s[%d];\n", f->name, f->length);
+                    break;
+                case FIELD_STRUCT:
+                    fprintf(out, "    %s %s;\n", f->struct_name, f->name);
+                    break;
+            }
+        }
+        fprintf(out, "} %s;\n\n", s->name);
+    }
+
+    for (int i = 0; i < nStructs; i++)
+    {
+        fprintf(out, "bool parse_%s(char ** input, %s * out);\n", structs[i].name, structs[i].name);
+        fprintf(out, "size_t dump_%s(%s * in, char * destination);\n\n", structs[i].name, structs[i].name);
+    }
+
+    fprintf(out, "#endif\n");
+}
+
+void write_member_parser(FILE * out, Field * f)
+{
+    switch (f->type)
+    {
+        case FIELD_FLOAT:
+            fprintf(out, "scan_JsonNumber(input, &out->%s)", f->name);
+            break;
+        case FIELD_INT:
+            fprintf(out, "scan_JsonInt(input, &out->%s)", f->name);
+            break;
+        case FIELD_DOUBLE:
+            fprintf(out, "scan_JsonDouble(input, &out->%s)", f->name);
+            break;
+        case FIELD_BOOL:
+            fprintf(out, "_scan_bool(input, &out->%s)", f->name);
+            break;
+        case FIELD_STRING:
+            fprintf(out, "scan_JsonString(input, out->%s, %d)", f->name, f->length);
+            break;
+        case FIELD_STRUCT:
+            fprintf(out, "parse_%s(input, &out->%s)", f->struct_name, f->name);
+            break;
+    }
+}
+
+void write_parser(FILE * out, Struct * s)
+{
+    // Members are dispatched on key length first, so most keys are rejected
+    // or accepted by a single memcmp.
+    fprintf(out, "static bool _parse_%s_member(char ** input, char * key, %s * out)\n{\n", s->name, s->name);
+    fprintf(out, "    switch (strlen(key))\n    {\n");
+    for (size_t length = 0; length < MAX_NAME_LENGTH; length++)
+    {
+        bool caseWritten = false;
+        for (int j = 0; j < s->nFields; j++)
+        {
+            Field * f = &s->fields[j];
+            if (strlen(f->name) != length)
+            {
+                continue;
+            }
+            if (!caseWritten)
+            {
+                fprintf(out, "        case %zu:\n", length);
+                caseWritten = true;
+            }
+            fprintf(out, "            if (memcmp(key, \"%s\", %zu) == 0) return ", f->name, length);
+            write_member_parser(out, f);
+            fprintf(out, ";\n");
+        }
+        if (caseWritten)
+        {
+            fprintf(out, "            break;\n");
+        }
+    }
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    return skip_JsonValue(input);\n}\n\n");
+
+    fprintf(out, "bool parse_%s(char ** input, %s * out)\n{\n", s->name, s->name);
+    fprintf(out, "    char key[GENERATED_KEY_LENGTH];\n");
+    fprintf(out, "    memset(out, 0, sizeof(%s));\n\n", s->name);
+    fprintf(out, "    skip_JsonWhitespace(input);\n");
+    fprintf(out, "    if (**input != '{') return false;\n");
+    fprintf(out, "    (*input)++;\n");
+    fprintf(out, "    skip_JsonWhitespace(input);\n");
+    fprintf(out, "    if (**input == '}')\n    {\n        (*input)++;\n        return true;\n    }\n\n");
+    fprintf(out, "    while (true)\n    {\n");
+    fprintf(out, "        skip_JsonWhitespace(input);\n");
+    fprintf(out, "        if (!scan_JsonString(input, key, GENERATED_KEY_LENGTH)) return false;\n");
+    fprintf(out, "        skip_JsonWhitespace(input);\n");
+    fprintf(out, "        if (**input != ':') return false;\n");
+    fprintf(out, "        (*input)++;\n");
+    fprintf(out, "        skip_JsonWhitespace(input);\n");
+    fprintf(out, "        if (!_parse_%s_member(input, key, out)) return false;\n", s->name);
+    fprintf(out, "        skip_JsonWhitespace(input);\n");
+    fprintf(out, "        switch (*((*input)++))\n        {\n");
+    fprintf(out, "            case ',':\n                break;\n");
+    fprintf(out, "            case '}':\n                return true;\n");
+    fprintf(out, "            default:\n                return false;\n");
+    fprintf(out, "        }\n    }\n}\n\n");
+}
+
+void write_dumper(FILE * out, Struct * s)
+{
+    fprintf(out, "size_t dump_%s(%s * in, char * destination)\n{\n", s->name, s->name);
+    fprintf(out, "    char * d = destination;\n");
+    fprintf(out, "    *(d++) = '{';\n");
+    for (int j = 0; j < s->nFields; j++)
+    {
+        Field * f = &s->fields[j];
+        size_t keyLength = strlen(f->name) + 3 + (j > 0);
+        fprintf(out, "    memcpy(d, \"%s\\\"%s\\\":\", %zu);\n", j > 0 ? "," : "", f->name, keyLength);
+        fprintf(out, "    d += %zu;\n", keyLength);
+        switch (f->type)
+        {
+            case FIELD_FLOAT:
+                fprintf(out, "    d += dump_JsonFloat(in->%s, d);\n", f->name);
+                break;
+            case FIELD_INT:
+                fprintf(out, "    d += dump_JsonInt(in->%s, d);\n", f->name);
+                break;
+            case FIELD_DOUBLE:
+                fprintf(out, "    d += dump_JsonDouble(in->%s, d);\n", f->name);
+                break;
+            case FIELD_BOOL:
+                fprintf(out, "    d += _dump_bool(in->%s, d);\n", f->name);
+                break;
+            case FIELD_STRING:
+                fprintf(out, "    d += dump_JsonString(in->%s, d);\n", f->name);
+                break;
+            case FIELD_STRUCT:
+                fprintf(out, "    d += dump_%s(&in->%s, d);\n", f->struct_name, f->name);
+                break;
+        }
+    }
+    fprintf(out, "    *(d++) = '}';\n");
+    fprintf(out, "    *d = '\\0';\n\n");
+    fprintf(out, "    return d - destination;\n}\n\n");
+}
+
+void write_source(FILE * out, char * header)
+{
+    fprintf(out, "// Generated by generator.c. Do not edit.\n\n");
+    fprintf(out, "#include <string.h>\n#include \"json.h\"\n#include \"%s\"\n\n", header);
+    fprintf(out, "#define GENERATED_KEY_LENGTH 256\n\n");
+
+    fprintf(out, "static bool _scan_bool(char ** input, bool * out)\n{\n");
+    fprintf(out, "    if (strncmp(*input, \"true\", 4) == 0)\n    {\n");
+    fprintf(out, "        *out = true;\n        *input += 4;\n        return true;\n    }\n");
+    fprintf(out, "    if (strncmp(*input, \"false\", 5) == 0)\n    {\n");
+    fprintf(out, "        *out = false;\n        *input += 5;\n        return true;\n    }\n");
+    fprintf(out, "    return false;\n}\n\n");
+
+    fprintf(out, "static size_t _dump_bool(bool b, char * destination)\n{\n");
+    fprintf(out, "    if (b)\n    {\n        memcpy(destination, \"true\", 4);\n        return 4;\n    }\n");
+    fprintf(out, "    memcpy(destination, \"false\", 5);\n    return 5;\n}\n\n");
+
+    for (int i = 0; i < nStructs; i++)
+    {
+        write_parser(out, &structs[i]);
+        write_dumper(out, &structs[i]);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <schema> <output prefix>\n", argv[0]);
+        return 1;
+    }
+
+    FILE * schema = fopen(argv[1], "r");
+    if (!schema)
+    {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+    bool success = read_schema(schema);
+    fclose(schema);
+    if (!success)
+    {
+        return 1;
+    }
+
+    char path[512];
+    char guard[512];
+    char * base = strrchr(argv[2], '/');
+    base = base ? base + 1 : argv[2];
+
+    // Header guard derived from the output file name, e.g. MESSAGE_H
+    size_t i = 0;
+    for (; base[i] && i < sizeof(guard) - 3; i++)
+    {
+        char c = base[i];
+        guard[i] = (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ? c : '_');
+    }
+    strcpy(guard + i, "_H");
+
+    snprintf(path, sizeof(path), "%s.h", argv[2]);
+    FILE * header = fopen(path, "w");
+    if (!header)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return 1;
+    }
+    write_header(header, guard);
+    fclose(header);
+
+    char headerName[512];
+    snprintf(headerName, sizeof(headerName), "%s.h", base);
+    snprintf(path, sizeof(path), "%s.c", argv[2]);
+    FILE * source = fopen(path, "w");
+    if (!source)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        return 1;
+    }
+    write_source(source, headerName);
+    fclose(source);
+
+    return 0;
+}
@@ -11,6 +11,11 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdalign.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #ifndef alignof
     // Define alignof for C99 compatibility
     // Credit to Martin Buchholz from: http://www.wambold.com/Martin/writings/alignof.html
@@ -18,68 +23,321 @@
 #endif
 #include "json.h"
 
+#ifdef JSON_PROFILE
+    #if defined(__x86_64__) || defined(__i386__)
+        #include <x86intrin.h>
+        #define _json_cycles() __rdtsc()
+    #else
+        #include <time.h>
+        // No cycle counter available, so fall back to nanoseconds.
+        static unsigned long long _json_cycles()
+        {
+            struct timespec ts;
+            timespec_get(&ts, TIME_UTC);
+            return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        }
+    #endif
+
+    // Each thread counts its own parses.
+    static _Thread_local JsonProfile json_profile;
+    #define PROFILE_ADD(counter, n) (json_profile.counter += (n))
+    #define PROFILE_START(timer) unsigned long long timer##_start = _json_cycles()
+    #define PROFILE_STOP(timer) (json_profile.timer += _json_cycles() - timer##_start)
+#else
+    #define PROFILE_ADD(counter, n)
+    #define PROFILE_START(timer)
+    #define PROFILE_STOP(timer)
+#endif
+
 #define CONSOLE_RED "\x1B[31m"
 #define CONSOLE_RESET "\x1B[0m"
 
-typedef struct Mempool
-{
-    u_int8_t * start;
-    u_int8_t * end;
-    u_int8_t * top;
-} Mempool;
+JsonMempool default_pool = { .end=NULL, .top=NULL };
+
+// The mempool that objects are currently allocated from. Offsets inside objects
+// are relative to its start.
+JsonMempool * buffer = &default_pool;
 
-Mempool buffer = { .end=NULL, .top=NULL };
+// The region of the active mempool that this thread allocates from while parsing
+// a slice of parse_JsonObject_parallel, or NULL for the rest of the mempool.
+_Thread_local JsonMempool * region = NULL;
+
+void Json_init_mempool(JsonMempool * pool, void * start, size_t size)
+{
+    pool->start = start;
+    pool->top = start;
+    pool->end = pool->start + size;
+    memset(&pool->stats, 0, sizeof(JsonMempoolStats));
+}
 
 void Json_set_mempool(void * start, size_t size)
 {
-    buffer.start = start;
-    buffer.top = start;
-    buffer.end = buffer.start + size;
+    Json_init_mempool(&default_pool, start, size);
+    buffer = &default_pool;
+}
+
+void Json_use_mempool(JsonMempool * pool)
+{
+    buffer = pool;
+}
+
+JsonMempool * Json_get_mempool()
+{
+    return buffer;
 }
 
 void Json_reset_mempool()
 {
-    buffer.top = buffer.start;
+    buffer->top = buffer->start;
+
+    // Only the high water mark and the last parse outlive a reset.
+    JsonMempoolStats stats = buffer->stats;
+    memset(&buffer->stats, 0, sizeof(JsonMempoolStats));
+    buffer->stats.high_water = stats.high_water;
+    buffer->stats.last_parse_input = stats.last_parse_input;
+    buffer->stats.last_parse_used = stats.last_parse_used;
+}
+
+JsonMempoolMark Json_mempool_mark()
+{
+    return (JsonMempoolMark) { .pool = buffer, .used = buffer->top - buffer->start };
+}
+
+// Stats keep counting the released allocations until the next reset.
+bool Json_mempool_release(JsonMempoolMark mark)
+{
+    if (mark.pool != buffer || mark.used > (size_t)(buffer->top - buffer->start))
+    {
+        return false;
+    }
+
+    buffer->top = buffer->start + mark.used;
+    return true;
+}
+
+void Json_get_mempool_stats(JsonMempoolStats * stats)
+{
+    *stats = buffer->stats;
+    stats->size = buffer->end - buffer->start;
+    stats->used = buffer->top - buffer->start;
 }
 
-void * _json_alloc(size_t size, size_t alignment) 
+void * _pool_alloc(JsonMempool * pool, size_t size, size_t alignment, JsonAllocKind kind)
 {
-    if (!buffer.end)
+    if (!pool->end)
     {
-        printf("Mempool not allocated.\n");
         return NULL;
     }
 
     // Alignment
     // Check to see if the current top is aligned.
     int padding = 0;
-    int remainder = (size_t) buffer.top % alignment;
+    int remainder = (size_t) pool->top % alignment;
     if (remainder != 0)
     {
         padding = alignment - remainder;
-        buffer.top += padding;
     }
 
-    void * loc = (void *) buffer.top;
-    buffer.top += size;
+    if (pool->top + padding + size >= pool->end)
+    {
+        pool->stats.failed++;
+        return NULL;
+    }
+
+    pool->top += padding;
+    void * loc = (void *) pool->top;
+    pool->top += size;
 
-    if (buffer.top >= buffer.end)
+    pool->stats.padding += padding;
+    pool->stats.allocations[kind]++;
+    pool->stats.bytes[kind] += size;
+    if ((size_t)(pool->top - pool->start) > pool->stats.high_water)
     {
-        printf("Out of memory!\n");
-        loc = NULL;
+        pool->stats.high_water = pool->top - pool->start;
     }
 
     #ifdef DEBUG_JSON
     printf("Requested: %lu ", size);
     printf("Alignment: %lu ", alignment);
     printf("Padding: %d ", padding);
-    printf("Free bytes: %lu ", (size_t)(buffer.end - buffer.top + 1));
-    printf("Top: %p\n", (void *)buffer.top);
+    printf("Free bytes: %lu ", (size_t)(pool->end - pool->top + 1));
+    printf("Top: %p\n", (void *)pool->top);
     #endif
 
     return loc;
 }
 
+// The pool this thread allocates from: its region, or the active mempool.
+JsonMempool * _json_pool()
+{
+    return region ? region : buffer;
+}
+
+void * _json_alloc(size_t size, size_t alignment, JsonAllocKind kind)
+{
+    return _pool_alloc(_json_pool(), size, alignment, kind);
+}
+
+#ifdef JSON_COMPACT_VALUES
+// A compact slot whose top 16 bits are at least SLOT_BOXED is a negative quiet
+// NaN, which is never stored as a double since NaNs are made canonical. The low
+// 3 bits of the top 16 are the tag, and the bottom 48 bits its payload.
+#define SLOT_SHIFT 48
+#define SLOT_BOXED 0xFFF8ULL
+#define SLOT_PAYLOAD 0xFFFFFFFFFFFFULL
+#define SLOT_SIGN 0x800000000000ULL
+#define SLOT_NAN 0x7FF8000000000000ULL
+
+typedef enum
+{
+    SLOT_CONSTANT,  // 0 is null, 1 is false and 2 is true
+    SLOT_FLOAT,     // The float's bits
+    SLOT_INT,       // A 48 bit two's complement integer
+    SLOT_BIG_INT,   // Mempool offset of an int64_t
+    SLOT_STRING,    // Mempool offset of the characters
+    SLOT_OBJECT,    // Mempool offset of the JsonObject
+    SLOT_ARRAY      // Mempool offset of the JsonArray
+} _SlotTag;
+#endif
+
+// Decodes a slot of the active mempool.
+JsonValue _slot_get(JsonSlot * slot)
+{
+    #ifdef JSON_COMPACT_VALUES
+    JsonValue value = { .flags = 0 };
+    u_int64_t payload = *slot & SLOT_PAYLOAD;
+    if ((*slot >> SLOT_SHIFT) < SLOT_BOXED)
+    {
+        value.type = JSON_DOUBLE;
+        memcpy(&value.data.d, slot, sizeof(double));
+        return value;
+    }
+
+    switch ((*slot >> SLOT_SHIFT) - SLOT_BOXED)
+    {
+        case SLOT_CONSTANT:
+            value.type = payload ? JSON_BOOL : JSON_NULL;
+            value.data.b = payload == 2;
+            break;
+        case SLOT_FLOAT:
+        {
+            u_int32_t bits = payload;
+            value.type = JSON_FLOAT;
+            memcpy(&value.data.f, &bits, sizeof(float));
+            break;
+        }
+        case SLOT_INT:
+            // Sign extends the low 48 bits.
+            value.type = JSON_INT;
+            value.data.i = (int64_t)((payload ^ SLOT_SIGN) - SLOT_SIGN);
+            break;
+        case SLOT_BIG_INT:
+            value.type = JSON_INT;
+            memcpy(&value.data.i, buffer->start + payload, sizeof(int64_t));
+            break;
+        case SLOT_STRING:
+            value.type = JSON_STRING;
+            value.data.s = (char *)(buffer->start + payload);
+            break;
+        case SLOT_OBJECT:
+            value.type = JSON_OBJECT;
+            value.data.o = (JsonObject *)(buffer->start + payload);
+            break;
+        case SLOT_ARRAY:
+            value.type = JSON_ARRAY;
+            value.data.a = (JsonArray *)(buffer->start + payload);
+            break;
+        default:
+            value.type = JSON_ERROR;
+            value.data.e = INVALID_TYPE;
+            break;
+    }
+    return value;
+    #else
+    return *slot;
+    #endif
+}
+
+// Encodes value into a slot of pool, whose start any pointers in value are
+// relative to. Only fails if a compact slot has to box an integer and pool is full.
+// Boxes are allocated from pool, so callers writing into the active mempool must
+// pass _json_pool(), which is the slice's region rather than buffer in a parallel
+// parse.
+bool _slot_set(JsonSlot * slot, JsonValue value, JsonMempool * pool)
+{
+    #ifdef JSON_COMPACT_VALUES
+    u_int64_t tag;
+    u_int64_t payload;
+    switch (value.type)
+    {
+        case JSON_NULL:
+            tag = SLOT_CONSTANT;
+            payload = 0;
+            break;
+        case JSON_BOOL:
+            tag = SLOT_CONSTANT;
+            payload = value.data.b ? 2 : 1;
+            break;
+        case JSON_FLOAT:
+        {
+            u_int32_t bits;
+            memcpy(&bits, &value.data.f, sizeof(float));
+            tag = SLOT_FLOAT;
+            payload = bits;
+            break;
+        }
+        case JSON_INT:
+            if (value.data.i >= -(int64_t) SLOT_SIGN && value.data.i < (int64_t) SLOT_SIGN)
+            {
+                tag = SLOT_INT;
+                payload = (u_int64_t) value.data.i & SLOT_PAYLOAD;
+            }
+            else
+            {
+                int64_t * box = _pool_alloc(pool, sizeof(int64_t), alignof(int64_t), JSON_ALLOC_VALUE);
+                if (!box)
+                {
+                    return false;
+                }
+                *box = value.data.i;
+                tag = SLOT_BIG_INT;
+                payload = (u_int8_t *) box - pool->start;
+            }
+            break;
+        case JSON_DOUBLE:
+            if (value.data.d != value.data.d)
+            {
+                *slot = SLOT_NAN;
+            }
+            else
+            {
+                memcpy(slot, &value.data.d, sizeof(double));
+            }
+            return true;
+        case JSON_STRING:
+            tag = SLOT_STRING;
+            payload = (u_int8_t *) value.data.s - pool->start;
+            break;
+        case JSON_OBJECT:
+            tag = SLOT_OBJECT;
+            payload = (u_int8_t *) value.data.o - pool->start;
+            break;
+        case JSON_ARRAY:
+            tag = SLOT_ARRAY;
+            payload = (u_int8_t *) value.data.a - pool->start;
+            break;
+        default:
+            return false;
+    }
+    *slot = (SLOT_BOXED + tag) << SLOT_SHIFT | payload;
+    return true;
+    #else
+    (void) pool;
+    *slot = value;
+    return true;
+    #endif
+}
+
 const unsigned char DEFAULT_LETTER = 0x80;
 const u_int16_t DEFAULT_OBJECT_ADDRESS = 0xFFFF;
 void _set_default_JsonNode(JsonNode* node)
@@ -98,60 +356,106 @@ JsonObject* create_JsonObject()
 {
     JsonNode node;
     _set_default_JsonNode(&node);
-    JsonObject* obj = _json_alloc(sizeof(JsonObject), alignof(JsonObject));
-    obj->node = node;
+    JsonObject* obj = _json_alloc(sizeof(JsonObject), alignof(JsonObject), JSON_ALLOC_OBJECT);
+    if (obj)
+    {
+        obj->node = node;
+    }
 
     return obj;
 }
 
-JsonValue get_value(JsonObject * obj, char * key)
+// Walks the trie to the node holding key's value, or returns NULL if there is
+// no such node. The node may not have a value.
+JsonNode * _find_JsonNode(JsonObject * obj, char * key)
 {
     JsonNode * node = &(obj->node);
 
     if (!(*key))
     {
-        while (*key != node->letter)
+        while ((unsigned char) *key != node->letter)
         {
-            node = (JsonNode*)(buffer.start + node->sibling);
-
-            if ((u_int8_t *) node - buffer.start == DEFAULT_OBJECT_ADDRESS)
+            if (node->sibling == DEFAULT_OBJECT_ADDRESS)
             {
-                return (JsonValue) {
-                    .type=JSON_ERROR, 
-                    .data.e=MISSING_KEY
-                };
+                return NULL;
             }
+            node = (JsonNode*)(buffer->start + node->sibling);
         }
     }
 
     while (*key)
     {
-        while (*key != node->letter)
+        while ((unsigned char) *key != node->letter)
         {
-            node = (JsonNode*)(buffer.start + node->sibling);
-            if ((u_int8_t *) node - buffer.start == DEFAULT_OBJECT_ADDRESS)
+            if (node->sibling == DEFAULT_OBJECT_ADDRESS)
             {
-                return (JsonValue) {
-                    .type=JSON_ERROR, 
-                    .data.e=MISSING_KEY
-                };
+                return NULL;
             }
+            node = (JsonNode*)(buffer->start + node->sibling);
         }
 
-        node = (JsonNode*)(buffer.start + node->child);
-        if ((u_int8_t *) node - buffer.start == DEFAULT_OBJECT_ADDRESS)
+        if (node->child == DEFAULT_OBJECT_ADDRESS)
         {
-            return (JsonValue) {
-                .type=JSON_ERROR, 
-                .data.e=MISSING_KEY
-            };
+            return NULL;
         }
+        node = (JsonNode*)(buffer->start + node->child);
         key++;
     }
 
-    if (node->data != DEFAULT_OBJECT_ADDRESS)
+    return node;
+}
+
+// Objects in an array of records can share one key trie, called a shape, and
+// only keep a vector of their own values. The node of such an object is not a
+// trie root: its letter is SHAPED_LETTER, its child the offset of the shape, and
+// its data the offset of the vector. The nodes of a shape hold byte offsets into
+// the vector instead of into the mempool. No key starts with a UTF-8
+// continuation byte, so like DEFAULT_LETTER, this cannot be a real root.
+const unsigned char SHAPED_LETTER = 0x81;
+
+typedef struct _Shape
+{
+    JsonNode node;          // Root of the shared key trie
+    u_int16_t length;       // Number of keys, and of values in every vector
+} _Shape;
+
+bool _is_shaped(JsonObject * obj)
+{
+    return obj->node.letter == SHAPED_LETTER;
+}
+
+u_int16_t _shape_length(JsonObject * obj)
+{
+    return ((_Shape *)(buffer->start + obj->node.child))->length;
+}
+
+// Returns the offset of the chain that holds obj's keys, and sets base to what
+// the data offsets of its nodes are relative to.
+u_int16_t _key_trie(JsonObject * obj, u_int8_t ** base)
+{
+    if (_is_shaped(obj))
+    {
+        *base = buffer->start + obj->node.data;
+        return obj->node.child;
+    }
+    *base = buffer->start;
+    return (u_int8_t *) obj - buffer->start;
+}
+
+// Finds the slot holding key's value, or returns NULL.
+JsonSlot * _find_slot(JsonObject * obj, char * key)
+{
+    u_int8_t * base;
+    JsonNode * node = _find_JsonNode((JsonObject *)(buffer->start + _key_trie(obj, &base)), key);
+    return node && node->data != DEFAULT_OBJECT_ADDRESS ? (JsonSlot *)(base + node->data) : NULL;
+}
+
+JsonValue get_value(JsonObject * obj, char * key)
+{
+    JsonSlot * slot = _find_slot(obj, key);
+    if (slot)
     {
-        return *((JsonValue*)(buffer.start + node->data));
+        return _slot_get(slot);
     }
     else
     {
@@ -162,8 +466,56 @@ JsonValue get_value(JsonObject * obj, char * key)
     }
 }
 
+char * get_string(JsonValue * value)
+{
+    if (value->type != JSON_STRING)
+    {
+        return NULL;
+    }
+    return value->flags & JSON_VALUE_INLINE ? value->data.inline_s : value->data.s;
+}
+
+// Compact slots never hold inline strings, so their strings are in the mempool too.
+char * _slot_string(JsonSlot * slot)
+{
+    #ifdef JSON_COMPACT_VALUES
+    JsonValue value = _slot_get(slot);
+    return value.type == JSON_STRING ? value.data.s : NULL;
+    #else
+    return get_string(slot);
+    #endif
+}
+
+// Unlike get_value, this points into the mempool, so inline strings stay valid.
+char * get_value_string(JsonObject * obj, char * key)
+{
+    JsonSlot * slot = _find_slot(obj, key);
+    return slot ? _slot_string(slot) : NULL;
+}
+
+bool _unshape_JsonObject(JsonObject * obj, u_int16_t filled);
+
+bool remove_value(JsonObject * obj, char * key)
+{
+    if (_is_shaped(obj) && (!_find_slot(obj, key) || !_unshape_JsonObject(obj, _shape_length(obj))))
+    {
+        return false;
+    }
+
+    // The trie nodes are left in place, since the mempool never frees anyway.
+    JsonNode * node = _find_JsonNode(obj, key);
+    if (!node || node->data == DEFAULT_OBJECT_ADDRESS)
+    {
+        return false;
+    }
+
+    node->data = DEFAULT_OBJECT_ADDRESS;
+    return true;
+}
+
 int _alloc_JsonElement(JsonValue * jd, void * data)
 {
+    jd->flags = 0;
     switch (jd->type)
     {
         case JSON_NULL:
@@ -171,8 +523,22 @@ int _alloc_JsonElement(JsonValue * jd, void * data)
             break;
         case JSON_STRING:
         {
-            char * destination = _json_alloc(strlen((char *) data) + 1, alignof(char));
-            strcpy(destination, (char *) data);
+            size_t length = strlen((char *) data) + 1;
+            #if defined(JSON_INLINE_STRINGS) && !defined(JSON_COMPACT_VALUES)
+            if (length <= JSON_INLINE_STRING_LENGTH)
+            {
+                memcpy(jd->data.inline_s, data, length);
+                jd->flags |= JSON_VALUE_INLINE;
+                break;
+            }
+            #endif
+
+            char * destination = _json_alloc(length, alignof(char), JSON_ALLOC_STRING);
+            if (!destination)
+            {
+                return INVALID_TYPE;
+            }
+            memcpy(destination, data, length);
             jd->data.s = destination;
             break;
         }
@@ -182,6 +548,12 @@ int _alloc_JsonElement(JsonValue * jd, void * data)
         case JSON_FLOAT:
             jd->data.f = *((float *) data);
             break;
+        case JSON_INT:
+            jd->data.i = *((int64_t *) data);
+            break;
+        case JSON_DOUBLE:
+            jd->data.d = *((double *) data);
+            break;
         case JSON_OBJECT:
             jd->data.o = (JsonObject *) data;
             break;
@@ -197,22 +569,32 @@ int _alloc_JsonElement(JsonValue * jd, void * data)
     return 0;
 }
 
-bool _set_value(JsonObject * obj, char * key, void* data, JsonDataType type)
+JsonNode * _alloc_JsonNode(unsigned char letter)
 {
-    JsonValue* value = _json_alloc(sizeof(JsonValue), alignof(JsonValue));
-    value->type = type;
+    JsonNode * node = _json_alloc(sizeof(JsonNode), alignof(JsonNode), JSON_ALLOC_NODE);
+    if (node)
+    {
+        _set_default_JsonNode(node);
+        node->letter = letter;
+    }
+    return node;
+}
 
-    int status = _alloc_JsonElement(value, data);
-    if (status < 0)
+// Walks the trie to the node that holds key's value, creating any nodes that do
+// not exist yet. Returns NULL if the mempool runs out.
+JsonNode * _insert_JsonNode(JsonObject * obj, char * key)
+{
+    // Adding to a shaped object gives it a trie of its own.
+    if (_is_shaped(obj) && !_unshape_JsonObject(obj, _shape_length(obj)))
     {
-        return false;
+        return NULL;
     }
 
     JsonNode * node = &(obj->node);
     // Check if the JSON node is set to its default values. If that is the case,
     // we can save an extra allocation by chaning the default value's key rather
     // than by creating a sibling.
-    if (node->letter & DEFAULT_LETTER)
+    if (node->letter == DEFAULT_LETTER)
     {
         _set_default_JsonNode(node);
         node->letter = *key;
@@ -220,16 +602,15 @@ bool _set_value(JsonObject * obj, char * key, void* data, JsonDataType type)
 
     if (!(*key))
     {
-        while (*key != node->letter)
+        while ((unsigned char) *key != node->letter)
         {
             if (node->sibling == DEFAULT_OBJECT_ADDRESS)
             {
-                JsonNode * sibling = _json_alloc(sizeof(JsonNode), alignof(JsonNode));
-                _set_default_JsonNode(sibling);
-                sibling->letter = *key;
-                node->sibling = ((u_int8_t *) sibling - buffer.start);
+                JsonNode * sibling = _alloc_JsonNode(*key);
+                if (!sibling) return NULL;
+                node->sibling = ((u_int8_t *) sibling - buffer->start);
             }
-            node = (JsonNode*)(buffer.start + node->sibling);
+            node = (JsonNode*)(buffer->start + node->sibling);
         }
     }
 
@@ -237,16 +618,15 @@ bool _set_value(JsonObject * obj, char * key, void* data, JsonDataType type)
     while (*key)
     {
         // Otherwise traverse sideways until a matching letter is found
-        while (*key != node->letter)
+        while ((unsigned char) *key != node->letter)
         {
             if (node->sibling == DEFAULT_OBJECT_ADDRESS)
             {
-                JsonNode * sibling = _json_alloc(sizeof(JsonNode), alignof(JsonNode));
-                _set_default_JsonNode(sibling);
-                sibling->letter = *key;
-                node->sibling = ((u_int8_t *) sibling - buffer.start);
+                JsonNode * sibling = _alloc_JsonNode(*key);
+                if (!sibling) return NULL;
+                node->sibling = ((u_int8_t *) sibling - buffer->start);
             }
-            node = (JsonNode*)(buffer.start + node->sibling);
+            node = (JsonNode*)(buffer->start + node->sibling);
         }
 
         // Check if the next character is null terminating.
@@ -256,918 +636,5275 @@ bool _set_value(JsonObject * obj, char * key, void* data, JsonDataType type)
         key++;
         if (node->child == DEFAULT_OBJECT_ADDRESS)
         {
-            JsonNode * child = _json_alloc(sizeof(JsonNode), alignof(JsonNode));
-            _set_default_JsonNode(child);
-            child->letter = *key;
-            node->child = ((u_int8_t *) child - buffer.start);
+            JsonNode * child = _alloc_JsonNode(*key);
+            if (!child) return NULL;
+            node->child = ((u_int8_t *) child - buffer->start);
         }
-        node = (JsonNode*)(buffer.start + node->child);
+        node = (JsonNode*)(buffer->start + node->child);
     }
 
-    node->data = ((u_int8_t *) value - buffer.start);
-    return true;
+    return node;
 }
 
-bool set_value_null(JsonObject * obj, char * key)
+// Writes the key whose value is at offset value of a shape into key, by
+// searching the chain at offset and everything below it.
+bool _shape_key(u_int16_t offset, u_int16_t value, char * key, int depth)
 {
-    return _set_value(obj, key, NULL, JSON_NULL);
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        if (node->data == value)
+        {
+            key[depth] = '\0';
+            return true;
+        }
+
+        key[depth] = node->letter;
+        if (_shape_key(node->child, value, key, depth + 1))
+        {
+            return true;
+        }
+        offset = node->sibling;
+    }
+    return false;
 }
 
-bool set_value_string(JsonObject * obj, char * key, char * str)
+// Gives a shaped object its own key trie again, holding the first filled values
+// of its vector. Keys are added in vector order, which is the order they were
+// set in, so the trie comes out as if the object had never been shaped. The
+// trie is built under a root of its own, and only replaces the shaped node
+// once every key is in, so an object that runs out of memory stays shaped.
+bool _unshape_JsonObject(JsonObject * obj, u_int16_t filled)
 {
-    return _set_value(obj, key, str, JSON_STRING);
+    u_int16_t shape = obj->node.child;
+    u_int16_t values = obj->node.data;
+    char key[JSON_KEY_LENGTH];
+    JsonObject unshaped;
+    _set_default_JsonNode(&(unshaped.node));
+
+    for (u_int16_t i = 0; i < filled; i++)
+    {
+        u_int16_t offset = i * sizeof(JsonSlot);
+        JsonNode * node = _shape_key(shape, offset, key, 0) ? _insert_JsonNode(&unshaped, key) : NULL;
+        if (!node)
+        {
+            return false;
+        }
+        node->data = values + offset;
+    }
+    obj->node = unshaped.node;
+    return true;
 }
 
-bool set_value_bool(JsonObject * obj, char * key, bool data)
+// Shapes are only made for objects with at most this many keys.
+#define JSON_SHAPE_LENGTH 64
+
+// Collects the nodes holding values in the chain at offset and below it. Returns
+// the new count, or -1 if there are too many, or a key is too long.
+int _collect_shape_values(u_int16_t offset, JsonNode ** nodes, int count, int depth)
 {
-    return _set_value(obj, key, &data, JSON_BOOL);
+    while (offset != DEFAULT_OBJECT_ADDRESS && count >= 0)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            if (count == JSON_SHAPE_LENGTH || depth >= JSON_KEY_LENGTH)
+            {
+                return -1;
+            }
+            nodes[count++] = node;
+        }
+        count = _collect_shape_values(node->child, nodes, count, depth + 1);
+        offset = node->sibling;
+    }
+    return count;
 }
 
-bool set_value_float(JsonObject * obj, char * key, float data)
+// Turns obj's trie into a shape that objects with the same keys can share, and
+// moves its values into a vector. Slots are allocated as keys are set, so
+// their offsets give the order the keys were set in.
+bool _shape_JsonObject(JsonObject * obj)
 {
-    return _set_value(obj, key, &data, JSON_FLOAT);
+    JsonNode * nodes[JSON_SHAPE_LENGTH];
+    _Shape * shape = obj->node.letter != DEFAULT_LETTER ?
+        _json_alloc(sizeof(_Shape), alignof(_Shape), JSON_ALLOC_NODE) : NULL;
+    if (!shape)
+    {
+        return false;
+    }
+    shape->node = obj->node;
+
+    int length = _collect_shape_values((u_int8_t *) shape - buffer->start, nodes, 0, 0);
+    JsonSlot * values = length > 0 ? _json_alloc(sizeof(JsonSlot) * length, alignof(JsonSlot), JSON_ALLOC_VALUE) : NULL;
+    if (!values)
+    {
+        return false;
+    }
+
+    for (int i = 1; i < length; i++)
+    {
+        for (int j = i; j > 0 && nodes[j - 1]->data > nodes[j]->data; j--)
+        {
+            JsonNode * swap = nodes[j];
+            nodes[j] = nodes[j - 1];
+            nodes[j - 1] = swap;
+        }
+    }
+    for (int i = 0; i < length; i++)
+    {
+        values[i] = *((JsonSlot *)(buffer->start + nodes[i]->data));
+        nodes[i]->data = i * sizeof(JsonSlot);
+    }
+
+    shape->length = length;
+    _set_default_JsonNode(&(obj->node));
+    obj->node.letter = SHAPED_LETTER;
+    obj->node.child = (u_int8_t *) shape - buffer->start;
+    obj->node.data = (u_int8_t *) values - buffer->start;
+    return true;
 }
 
-bool set_value_object(JsonObject * obj, char * key, JsonObject * object)
+// Creates an object with the keys of shape, whose values are yet to be set.
+JsonObject * _create_shaped_JsonObject(u_int16_t shape)
 {
-    return _set_value(obj, key, object, JSON_OBJECT);
+    u_int16_t length = ((_Shape *)(buffer->start + shape))->length;
+    JsonObject * obj = _json_alloc(sizeof(JsonObject), alignof(JsonObject), JSON_ALLOC_OBJECT);
+    JsonSlot * values = _json_alloc(sizeof(JsonSlot) * length, alignof(JsonSlot), JSON_ALLOC_VALUE);
+    if (!obj || !values)
+    {
+        return NULL;
+    }
+
+    _set_default_JsonNode(&(obj->node));
+    obj->node.letter = SHAPED_LETTER;
+    obj->node.child = shape;
+    obj->node.data = (u_int8_t *) values - buffer->start;
+    return obj;
 }
 
-bool set_value_array(JsonObject * obj, char * key, JsonArray * array)
+// Finds the slot for the index'th key of a shaped object, as long as key is that key.
+JsonSlot * _shape_slot(JsonObject * obj, char * key, u_int16_t index)
 {
-    return _set_value(obj, key, array, JSON_ARRAY);
+    u_int8_t * base;
+    JsonNode * node = _find_JsonNode((JsonObject *)(buffer->start + _key_trie(obj, &base)), key);
+    if (!node || index >= _shape_length(obj) || node->data != index * sizeof(JsonSlot))
+    {
+        return NULL;
+    }
+    return (JsonSlot *)(base + node->data);
 }
 
-JsonArray * create_JsonArray(u_int16_t length)
+bool _set_value(JsonObject * obj, char * key, void* data, JsonDataType type)
 {
-    JsonArray* j = _json_alloc(sizeof(JsonArray), alignof(JsonArray));
-    j->length = length;
+    PROFILE_START(tree_cycles);
+    JsonSlot * slot = _json_alloc(sizeof(JsonSlot), alignof(JsonSlot), JSON_ALLOC_VALUE);
+    if (!slot)
+    {
+        PROFILE_STOP(tree_cycles);
+        return false;
+    }
 
-    JsonValue * elements = _json_alloc(sizeof(JsonValue) * length, alignof(JsonArray));
-    j->elements = ((u_int8_t *) elements - buffer.start);
-    return j;
+    JsonValue value = { .type = type };
+    int status = _alloc_JsonElement(&value, data);
+    JsonNode * node = status < 0 || !_slot_set(slot, value, _json_pool()) ? NULL : _insert_JsonNode(obj, key);
+    if (!node)
+    {
+        PROFILE_STOP(tree_cycles);
+        return false;
+    }
+
+    node->data = ((u_int8_t *) slot - buffer->start);
+    PROFILE_STOP(tree_cycles);
+    return true;
 }
 
-int _set_element(JsonArray * j, u_int16_t index, void * data, JsonDataType type)
+// Sets key to a copy of an existing value, without copying what it points to.
+bool _set_JsonValue(JsonObject * obj, char * key, JsonValue * v)
 {
-    JsonValue *jd = &(((JsonValue*)(buffer.start + j->elements))[index]);
-    jd->type = type;
-    int status = _alloc_JsonElement(jd, data);
-    return status;
+    JsonSlot * slot = _json_alloc(sizeof(JsonSlot), alignof(JsonSlot), JSON_ALLOC_VALUE);
+    JsonNode * node = slot && _slot_set(slot, *v, _json_pool()) ? _insert_JsonNode(obj, key) : NULL;
+    if (!node)
+    {
+        return false;
+    }
+
+    node->data = ((u_int8_t *) slot - buffer->start);
+    return true;
 }
 
-bool set_element_null(JsonArray * j, u_int16_t index)
+bool set_value_null(JsonObject * obj, char * key)
 {
-    return _set_element(j, index, NULL, JSON_NULL);
+    return _set_value(obj, key, NULL, JSON_NULL);
 }
 
-bool set_element_string(JsonArray * j, u_int16_t index, char * str)
+bool set_value_string(JsonObject * obj, char * key, char * str)
 {
-    return _set_element(j, index, str, JSON_STRING);
+    return _set_value(obj, key, str, JSON_STRING);
 }
 
-bool set_element_bool(JsonArray * j, u_int16_t index, bool data)
+bool set_value_bool(JsonObject * obj, char * key, bool data)
 {
-    return _set_element(j, index, &data, JSON_BOOL);
+    return _set_value(obj, key, &data, JSON_BOOL);
 }
 
-bool set_element_float(JsonArray * j, u_int16_t index, float data)
+bool set_value_float(JsonObject * obj, char * key, float data)
 {
-    return _set_element(j, index, &data, JSON_FLOAT);
+    return _set_value(obj, key, &data, JSON_FLOAT);
 }
 
-bool set_element_object(JsonArray * j, u_int16_t index, JsonObject * object)
+bool set_value_int(JsonObject * obj, char * key, int64_t data)
 {
-    return _set_element(j, index, object, JSON_OBJECT);
+    return _set_value(obj, key, &data, JSON_INT);
 }
 
-bool set_element_array(JsonArray * j, u_int16_t index, JsonArray * array)
+bool set_value_double(JsonObject * obj, char * key, double data)
 {
-    return _set_element(j, index, array, JSON_ARRAY);
+    return _set_value(obj, key, &data, JSON_DOUBLE);
 }
 
-JsonValue get_element(JsonArray * j, u_int16_t index)
+bool set_value_object(JsonObject * obj, char * key, JsonObject * object)
 {
-    if (index > j->length)
-    {
-        return (JsonValue) {
-            .type=JSON_ERROR, 
-            .data.e=INDEX_OUT_OF_BOUNDS
-        };
-    }
-    return ((JsonValue*)(buffer.start + j->elements))[index];
+    return _set_value(obj, key, object, JSON_OBJECT);
 }
 
-#define JSON_STACK_LENGTH 128
-typedef struct _Stack
+bool set_value_array(JsonObject * obj, char * key, JsonArray * array)
 {
-    void* stack[JSON_STACK_LENGTH];
-    int stacktop;
-} _Stack;
+    return _set_value(obj, key, array, JSON_ARRAY);
+}
 
-int push_ptr(_Stack* s, void* p)
+void obj_iter_begin(JsonObjectIterator * it, JsonObject * obj, char * key_buffer, size_t size)
 {
-    if (s->stacktop >= JSON_STACK_LENGTH - 1)
+    it->key_buffer = key_buffer;
+    it->key_buffer_size = size < JSON_KEY_LENGTH ? size : JSON_KEY_LENGTH;
+    it->top = 0;
+    it->nodes[0] = _key_trie(obj, &(it->base));
+    it->depths[0] = 0;
+    it->terminated = -1;
+}
+
+bool obj_iter_next(JsonObjectIterator * it, char ** key, size_t * length, JsonValue ** value)
+{
+    // Put back the letter that the last key's terminator replaced.
+    if (it->terminated >= 0)
     {
-        printf("Json: Stack overflow\n");
-        return -1;
+        it->key_buffer[it->terminated] = it->terminated_letter;
+        it->terminated = -1;
     }
 
-    (s->stacktop)++;
-    s->stack[s->stacktop] = p;
+    // Same depth first walk as the dumper. Children are popped before siblings,
+    // so at most one sibling per key depth is ever pending.
+    while (it->top >= 0)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + it->nodes[it->top]);
+        u_int16_t depth = it->depths[it->top];
+        it->top--;
+        it->key_buffer[depth] = node->letter;
 
-    return 0;
+        if (node->sibling != DEFAULT_OBJECT_ADDRESS)
+        {
+            it->top++;
+            it->nodes[it->top] = node->sibling;
+            it->depths[it->top] = depth;
+        }
+
+        if (node->child != DEFAULT_OBJECT_ADDRESS && depth + 1u < it->key_buffer_size)
+        {
+            it->top++;
+            it->nodes[it->top] = node->child;
+            it->depths[it->top] = depth + 1;
+        }
+
+        // A key's value hangs off the node one past its last letter. That node's
+        // letter may still be needed by longer keys, so it is restored next call.
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            it->terminated = depth;
+            it->terminated_letter = node->letter;
+            it->key_buffer[depth] = '\0';
+
+            *key = it->key_buffer;
+            *length = depth;
+            #ifdef JSON_COMPACT_VALUES
+            it->value = _slot_get((JsonSlot *)(it->base + node->data));
+            *value = &(it->value);
+            #else
+            *value = (JsonValue *)(it->base + node->data);
+            #endif
+            return true;
+        }
+    }
+
+    return false;
 }
 
-int push_int(_Stack* s, int i)
+JsonArray * create_JsonArray(u_int16_t length)
 {
-    if (s->stacktop >= JSON_STACK_LENGTH - 1)
+    JsonMempool * pool = _json_pool();
+    u_int8_t * top = pool->top;
+    JsonArray* j = _json_alloc(sizeof(JsonArray), alignof(JsonArray), JSON_ALLOC_ARRAY);
+    JsonSlot * elements = j ? _json_alloc(sizeof(JsonSlot) * length, alignof(JsonSlot), JSON_ALLOC_ELEMENTS) : NULL;
+    if (!elements)
     {
-        printf("Json: Stack overflow\n");
-        return -1;
+        // Give the header back, so an array that does not fit uses no memory.
+        if (j)
+        {
+            pool->stats.padding -= (u_int8_t *) j - top;
+            pool->stats.allocations[JSON_ALLOC_ARRAY]--;
+            pool->stats.bytes[JSON_ALLOC_ARRAY] -= sizeof(JsonArray);
+            pool->top = top;
+        }
+        return NULL;
     }
 
-    (s->stacktop)++;
-    ((int *)s->stack)[s->stacktop] = i;
+    j->length = length;
+    j->elements = ((u_int8_t *) elements - buffer->start);
+    return j;
+}
 
-    return 0;
+bool _set_slot(JsonSlot * slot, void * data, JsonDataType type)
+{
+    JsonValue value = { .type = type };
+    return _alloc_JsonElement(&value, data) >= 0 && _slot_set(slot, value, _json_pool());
 }
 
-void* pop_ptr(_Stack* s)
+bool _set_element(JsonArray * j, u_int16_t index, void * data, JsonDataType type)
 {
-    void *rval = s->stack[s->stacktop];
-    (s->stacktop)--;
+    return _set_slot(&(((JsonSlot*)(buffer->start + j->elements))[index]), data, type);
+}
 
-    return rval;
+bool set_element_null(JsonArray * j, u_int16_t index)
+{
+    return _set_element(j, index, NULL, JSON_NULL);
 }
 
-void* peek_ptr(_Stack* s)
+bool set_element_string(JsonArray * j, u_int16_t index, char * str)
 {
-    void *rval = s->stack[s->stacktop];
-    return rval;
+    return _set_element(j, index, str, JSON_STRING);
 }
 
-int pop_int(_Stack* s)
+bool set_element_bool(JsonArray * j, u_int16_t index, bool data)
 {
-    int rval = ((int*)s->stack)[s->stacktop];
-    (s->stacktop)--;
+    return _set_element(j, index, &data, JSON_BOOL);
+}
 
-    return rval;
+bool set_element_float(JsonArray * j, u_int16_t index, float data)
+{
+    return _set_element(j, index, &data, JSON_FLOAT);
 }
 
-int peek_int(_Stack* s)
+bool set_element_int(JsonArray * j, u_int16_t index, int64_t data)
 {
-    int rval = ((int*)s->stack)[s->stacktop];
-    return rval;
+    return _set_element(j, index, &data, JSON_INT);
 }
 
-typedef struct _Dumper
+bool set_element_double(JsonArray * j, u_int16_t index, double data)
 {
-    _Stack valstack;
-    _Stack bufend_stack;
-    _Stack objIndex_stack;
-    _Stack dump_stack;
-    char * destination;
-    char * key_buffer;
-} _Dumper;
+    return _set_element(j, index, &data, JSON_DOUBLE);
+}
 
-enum JsonDumpTypes
+bool set_element_object(JsonArray * j, u_int16_t index, JsonObject * object)
 {
-    Dump_JsonValue,
-    Dump_JsonObject,
-    Dump_JsonArray,
-    Dump_JsonObject_Key
-};
+    return _set_element(j, index, object, JSON_OBJECT);
+}
 
-char _JSON_NULL_STR[] = "null";
-char _JSON_FALSE_STR[] = "false";
-char _JSON_TRUE_STR[] = "true";
+bool set_element_array(JsonArray * j, u_int16_t index, JsonArray * array)
+{
+    return _set_element(j, index, array, JSON_ARRAY);
+}
 
-void _dump_JsonObject(JsonObject *o, _Dumper* dumper);
-void _dump_JsonValue(JsonValue *value, _Dumper* dumper);
-void _dump_JsonArray(JsonArray *ary, _Dumper* dumper);
-void _dump_JsonObject_Key(_Dumper * dumper, int bufStart, int bufEnd);
+JsonValue get_element(JsonArray * j, u_int16_t index)
+{
+    if (index >= j->length)
+    {
+        return (JsonValue) {
+            .type=JSON_ERROR, 
+            .data.e=INDEX_OUT_OF_BOUNDS
+        };
+    }
+    return _slot_get(&((JsonSlot*)(buffer->start + j->elements))[index]);
+}
 
-void _dump_JsonObject_Key(_Dumper * dumper, int bufStart, int bufEnd)
+char * get_element_string(JsonArray * j, u_int16_t index)
 {
-    *(dumper->destination++) = '"'; 
-    for (int i = bufStart; i <= bufEnd; i++)
+    if (index >= j->length)
     {
-        *(dumper->destination++) = dumper->key_buffer[i];
+        return NULL;
     }
-    *(dumper->destination++) = '"'; 
-    *(dumper->destination++) = ':'; 
+    return _slot_string(&((JsonSlot*)(buffer->start + j->elements))[index]);
 }
 
-void _dump_JsonArray(JsonArray *ary, _Dumper* dumper)
+bool _is_number(JsonDataType type)
 {
-    *(dumper->destination++) = '[';
-    for (int i = 0; i < ary->length; i++)
+    return type == JSON_FLOAT || type == JSON_INT || type == JSON_DOUBLE;
+}
+
+bool get_double(JsonValue value, double * out)
+{
+    switch (value.type)
     {
-        if (i > 0)
-        {
-            *(dumper->destination++) = ',';
-        }
+        case JSON_FLOAT:
+            *out = value.data.f;
+            return true;
+        case JSON_INT:
+            *out = value.data.i;
+            return true;
+        case JSON_DOUBLE:
+            *out = value.data.d;
+            return true;
+        default:
+            return false;
+    }
+}
 
-        JsonValue* element = &((JsonValue*)(buffer.start + ary->elements))[i];
-        switch (element->type)
-        {
-            case JSON_OBJECT:
-                _dump_JsonObject(element->data.o, dumper);
-                break;
-            default:
-                _dump_JsonValue(element, dumper);
-                break;
-        }
+bool get_int(JsonValue value, int64_t * out)
+{
+    double d;
+    if (value.type == JSON_INT)
+    {
+        *out = value.data.i;
+        return true;
     }
-    *(dumper->destination++) = ']';
+
+    // 2^63 is the first double past the end of the range.
+    if (!get_double(value, &d) || !(d >= -9223372036854775808.0 && d < 9223372036854775808.0) ||
+        d != (int64_t) d)
+    {
+        return false;
+    }
+    *out = d;
+    return true;
 }
 
-void _dump_JsonValue(JsonValue* value, _Dumper* dumper)
+// Cloning into another mempool. Objects built by the parser take up one contiguous
+// range of the pool, so a clone first measures the range its reachable data spans.
+// If that range is mostly reachable data, it is copied in one go and its offsets
+// and pointers rebased. Otherwise everything is copied one allocation at a time.
+
+typedef struct _Extent
+{
+    u_int8_t * low;
+    u_int8_t * high;
+    size_t reachable;
+} _Extent;
+
+void _extent_add(_Extent * e, void * p, size_t size)
+{
+    u_int8_t * start = p;
+    if (start < e->low) e->low = start;
+    if (start + size > e->high) e->high = start + size;
+    e->reachable += size;
+}
+
+void _extent_JsonObject(_Extent * e, JsonObject * obj);
+
+void _extent_JsonValue(_Extent * e, JsonValue * value)
 {
     switch (value->type)
     {
-        char *str;
-        case JSON_NULL:
-            str = _JSON_NULL_STR;
-            while (*str) *(dumper->destination++) = *(str++);
-            break;
         case JSON_STRING:
-            str = value->data.s;
-            *(dumper->destination++) = '"';
-            while (*str) *(dumper->destination++) = *(str++);
-            *(dumper->destination++) = '"';
-            break;
-        case JSON_BOOL:
-            str = value->data.b ? _JSON_TRUE_STR : _JSON_FALSE_STR;
-            while (*str) *(dumper->destination++) = *(str++);
-            break;
-        case JSON_FLOAT:
-            dumper->destination += sprintf(dumper->destination, "%g", value->data.f);
+            if (!(value->flags & JSON_VALUE_INLINE))
+            {
+                _extent_add(e, value->data.s, strlen(value->data.s) + 1);
+            }
             break;
         case JSON_OBJECT:
-            push_int(&dumper->objIndex_stack, dumper->valstack.stacktop);
-            push_ptr(&dumper->valstack, &(value->data.o->node));
-            push_int(&dumper->bufend_stack, 0);
-            *(dumper->destination++) = '{';
+            _extent_JsonObject(e, value->data.o);
             break;
         case JSON_ARRAY:
-            _dump_JsonArray(value->data.a, dumper);
+        {
+            JsonArray * array = value->data.a;
+            JsonSlot * elements = (JsonSlot *)(buffer->start + array->elements);
+            _extent_add(e, array, sizeof(JsonArray));
+            _extent_add(e, elements, sizeof(JsonSlot) * array->length);
+            for (int i = 0; i < array->length; i++)
+            {
+                JsonValue element = _slot_get(&elements[i]);
+                _extent_JsonValue(e, &element);
+            }
             break;
+        }
         default:
             break;
     }
 }
 
-void _dump_JsonObject(JsonObject *o, _Dumper * dumper)
+void _extent_JsonNode(_Extent * e, u_int16_t offset, u_int8_t * base)
 {
-    push_int(&dumper->objIndex_stack, dumper->valstack.stacktop);
-    push_ptr(&dumper->valstack, &(o->node));
-    push_int(&dumper->bufend_stack, 0);
-
-    int intial_valstack_top = dumper->valstack.stacktop;
-    int intial_objIndex_stack_top = dumper->objIndex_stack.stacktop;
-
-    *(dumper->destination++) = '{';
-    while (dumper->valstack.stacktop >= intial_valstack_top)
+    // Siblings are followed in a loop, so only children recurse.
+    while (offset != DEFAULT_OBJECT_ADDRESS)
     {
-        JsonNode* node = pop_ptr(&dumper->valstack);
-        int strIndex  = pop_int(&dumper->bufend_stack);  // This will update strIndex
-        dumper->key_buffer[strIndex] = node->letter;  // Add the current key to the buffer
-
-        // Add sibling to stack if exists
-        if (node->sibling != DEFAULT_OBJECT_ADDRESS)
-        {
-            JsonNode* sibling = (JsonNode*)(buffer.start + node->sibling); 
-            push_ptr(&dumper->valstack, sibling);
-            push_int(&dumper->bufend_stack, strIndex);
-        }
-
-        // Add child to stack if exists
-        if (node->child != DEFAULT_OBJECT_ADDRESS)
-        {
-            JsonNode* child = (JsonNode*)(buffer.start + node->child); 
-            push_ptr(&dumper->valstack, child);
-            push_int(&dumper->bufend_stack, strIndex + 1);
-        }
-
-        // Print current node if it's not empty
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        _extent_add(e, node, sizeof(JsonNode));
         if (node->data != DEFAULT_OBJECT_ADDRESS)
         {
-            if (*(dumper->destination - 1) != '{')
-            {
-                *(dumper->destination++) = ',';
-            }
-
-            _dump_JsonObject_Key(dumper, 0, strIndex - 1 );
-            JsonValue* value = (JsonValue*)(buffer.start + node->data);
-            _dump_JsonValue(value, dumper);
-        }
-
-        if (dumper->valstack.stacktop == peek_int(&dumper->objIndex_stack))
-        {
-            *(dumper->destination++) = '}';
-            pop_int(&dumper->objIndex_stack);
+            JsonSlot * slot = (JsonSlot *)(base + node->data);
+            JsonValue value = _slot_get(slot);
+            _extent_add(e, slot, sizeof(JsonSlot));
+            _extent_JsonValue(e, &value);
         }
+        _extent_JsonNode(e, node->child, base);
+        offset = node->sibling;
     }
+}
 
-    // Check this at the end, since nested objects will not check for the '}'
-    while (dumper->objIndex_stack.stacktop >= intial_objIndex_stack_top)
+void _extent_JsonObject(_Extent * e, JsonObject * obj)
+{
+    u_int8_t * base;
+    u_int16_t trie = _key_trie(obj, &base);
+    if (_is_shaped(obj))
     {
-        *(dumper->destination++) = '}';
-        pop_int(&dumper->objIndex_stack);
+        _extent_add(e, obj, sizeof(JsonObject));
+        _extent_add(e, buffer->start + trie, sizeof(_Shape));
     }
+    _extent_JsonNode(e, trie, base);
 }
 
-size_t dump_JsonObject(JsonObject* o, char* destination)
+typedef struct _Relocation
 {
-    char key_buffer[256];
-    _Dumper dumper;
-    dumper.key_buffer = key_buffer;
-    dumper.destination = destination;
-    dumper.valstack.stacktop = -1;
-    dumper.bufend_stack.stacktop = -1;
-    dumper.objIndex_stack.stacktop = -1;
+    u_int8_t * low;                 // Start of the copied range in the active mempool
+    u_int8_t * copy;                // Start of the copy in the destination
+    JsonMempool * destination;
+    bool failed;                    // Set if a compact slot could not box an integer
+} _Relocation;
 
-    _dump_JsonObject(o, &dumper);
-    *(dumper.destination) = '\0';
-    
-    return dumper.destination - destination;
+void * _relocate(_Relocation * r, void * p)
+{
+    return r->copy + ((u_int8_t *) p - r->low);
 }
 
-typedef struct _Parser
+u_int16_t _relocate_offset(_Relocation * r, u_int16_t offset)
 {
-    char* input;
-    char* buffer;
-    JsonValue* arrayBuffer;
-    _Stack jsonParseStack;
-    _Stack jsonObjectStack;
-    _Stack jsonBufferStack;
-    _Stack jsonDeserializeStack;
-} _Parser;
+    if (offset == DEFAULT_OBJECT_ADDRESS)
+    {
+        return offset;
+    }
+    return (u_int8_t *) _relocate(r, buffer->start + offset) - r->destination->start;
+}
 
-enum JsonParseTypes
+// Rebasing always reads from the source and writes to the copy, so subtrees that
+// are referenced more than once are simply rebased more than once. Compact slots
+// are re-encoded, and box their large integers again in the destination.
+void _relocate_JsonObject(_Relocation * r, JsonObject * obj);
+
+void _relocate_JsonValue(_Relocation * r, JsonSlot * slot)
 {
-    Parse_JsonObjectStart,
-    Parse_JsonMembers,
-    Parse_JsonElements,
-    Parse_JsonValue,
-    Parse_Colon,
-    Parse_JsonValueSeparator,
-    Parse_JsonElementSeparator,
-    Parse_JsonString,
-    Parse_JsonNumber,
-};
-
-// Create the jump table for the parser
-bool parse_JsonObjectStart(_Parser *);
-bool parse_JsonMembers(_Parser *);
-bool parse_JsonElements(_Parser *);
-bool parse_JsonValue(_Parser *);
-bool parse_Colon(_Parser *);
-bool parse_JsonValueSeparator(_Parser *);
-bool parse_JsonElementSeparator(_Parser *);
-bool parse_JsonString(_Parser *);
-bool parse_JsonNumber(_Parser *);
-bool (*_parser_jump_table[9])(_Parser*) =
-{
-    &parse_JsonObjectStart,
-    &parse_JsonMembers,
-    &parse_JsonElements,
-    &parse_JsonValue,
-    &parse_Colon,
-    &parse_JsonValueSeparator,
-    &parse_JsonElementSeparator,
-    &parse_JsonString,
-    &parse_JsonNumber,
-};
-
-enum JsonDeserializeTypes
-{
-    Deserialize_JsonObject,
-    Deserialize_JsonArray,
-};
+    JsonValue value = _slot_get(slot);
+    switch (value.type)
+    {
+        case JSON_STRING:
+            if (!(value.flags & JSON_VALUE_INLINE))
+            {
+                value.data.s = _relocate(r, value.data.s);
+            }
+            break;
+        case JSON_OBJECT:
+            _relocate_JsonObject(r, value.data.o);
+            value.data.o = _relocate(r, value.data.o);
+            break;
+        case JSON_ARRAY:
+        {
+            JsonArray * array = value.data.a;
+            JsonArray * arrayCopy = _relocate(r, array);
+            JsonSlot * elements = (JsonSlot *)(buffer->start + array->elements);
+            arrayCopy->elements = _relocate_offset(r, array->elements);
+            for (int i = 0; i < array->length; i++)
+            {
+                _relocate_JsonValue(r, &elements[i]);
+            }
+            value.data.a = arrayCopy;
+            break;
+        }
+        default:
+            break;
+    }
 
-void next_token(_Parser* p)
-{
-    #ifdef DEBUG_JSON
-    printf("Current token: '%c'\n", *p->input);
-    #endif
-    p->input++;
+    if (!_slot_set(_relocate(r, slot), value, r->destination))
+    {
+        r->failed = true;
+    }
 }
 
-void skip_whitespace(_Parser* parser)
+void _relocate_JsonNode(_Relocation * r, u_int16_t offset, u_int8_t * base)
 {
-    while (*(parser->input))
+    while (offset != DEFAULT_OBJECT_ADDRESS)
     {
-        switch (*(parser->input))
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        JsonNode * copy = _relocate(r, node);
+        copy->child = _relocate_offset(r, node->child);
+        copy->sibling = _relocate_offset(r, node->sibling);
+        if (base == buffer->start)
         {
-            case ' ':
-            case '\r':
-            case '\t':
-            case '\n':
-            case '\v':
-                break;
-            default:
-                return;
+            // Offsets into a shaped object's vector stay the same.
+            copy->data = _relocate_offset(r, node->data);
         }
-        next_token(parser);
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            _relocate_JsonValue(r, (JsonSlot *)(base + node->data));
+        }
+        _relocate_JsonNode(r, node->child, base);
+        offset = node->sibling;
     }
 }
 
-bool parse_JsonObjectStart(_Parser* parser)
+void _relocate_JsonObject(_Relocation * r, JsonObject * obj)
 {
-    #ifdef DEBUG_JSON
-    printf("Parsing object start\n");
-    #endif
-    skip_whitespace(parser);
-    switch (*(parser->input))
+    u_int8_t * base;
+    u_int16_t trie = _key_trie(obj, &base);
+    if (_is_shaped(obj))
     {
-        case '{':
-            pop_int(&parser->jsonParseStack);
-            push_int(&parser->jsonParseStack, Parse_JsonMembers);
-            push_ptr(&parser->jsonObjectStack, create_JsonObject());
-            push_int(&parser->jsonDeserializeStack, Deserialize_JsonObject);
-            next_token(parser);
-            return true;
-        default:
-            return false;
+        JsonObject * copy = _relocate(r, obj);
+        copy->node.child = _relocate_offset(r, obj->node.child);
+        copy->node.data = _relocate_offset(r, obj->node.data);
     }
-    next_token(parser);
+    _relocate_JsonNode(r, trie, base);
 }
 
-bool parse_JsonElements(_Parser* parser)
+typedef struct _Copier
 {
-    #ifdef DEBUG_JSON
-    printf("Parsing elements\n");
-    #endif
-    skip_whitespace(parser);
-    switch (*(parser->input))
+    JsonMempool * destination;
+    bool failed;
+} _Copier;
+
+u_int16_t _copy_JsonObject(_Copier * c, JsonObject * obj);
+
+void _copy_JsonValue(_Copier * c, JsonValue * value, JsonValue * copy)
+{
+    *copy = *value;
+    switch (value->type)
     {
-        case ']':
-            pop_int(&parser->jsonParseStack);
-            pop_int(&parser->jsonDeserializeStack);
-            JsonValue * lastElement = parser->arrayBuffer;
-            JsonValue * firstElement = pop_ptr(&parser->jsonObjectStack);
-            JsonArray * array = create_JsonArray(lastElement - firstElement);
-            for (int i = lastElement - firstElement - 1; i >= 0; i--)
+        case JSON_STRING:
+        {
+            if (value->flags & JSON_VALUE_INLINE)
+            {
+                break;
+            }
+            size_t length = strlen(value->data.s) + 1;
+            copy->data.s = _pool_alloc(c->destination, length, alignof(char), JSON_ALLOC_STRING);
+            if (!copy->data.s)
+            {
+                c->failed = true;
+                return;
+            }
+            memcpy(copy->data.s, value->data.s, length);
+            break;
+        }
+        case JSON_OBJECT:
+        {
+            u_int16_t offset = _copy_JsonObject(c, value->data.o);
+            copy->data.o = (JsonObject *)(c->destination->start + offset);
+            break;
+        }
+        case JSON_ARRAY:
+        {
+            JsonArray * array = value->data.a;
+            JsonArray * arrayCopy = _pool_alloc(c->destination, sizeof(JsonArray), alignof(JsonArray), JSON_ALLOC_ARRAY);
+            JsonSlot * elementsCopy = _pool_alloc(
+                c->destination, sizeof(JsonSlot) * array->length, alignof(JsonSlot), JSON_ALLOC_ELEMENTS);
+            if (!arrayCopy || !elementsCopy)
             {
-                JsonValue element = firstElement[i];
-                switch (element.type)
+                c->failed = true;
+                return;
+            }
+
+            arrayCopy->length = array->length;
+            arrayCopy->elements = (u_int8_t *) elementsCopy - c->destination->start;
+            copy->data.a = arrayCopy;
+
+            JsonSlot * elements = (JsonSlot *)(buffer->start + array->elements);
+            for (int i = 0; i < array->length && !c->failed; i++)
+            {
+                JsonValue element = _slot_get(&elements[i]);
+                JsonValue elementCopy;
+                _copy_JsonValue(c, &element, &elementCopy);
+                if (!c->failed && !_slot_set(&elementsCopy[i], elementCopy, c->destination))
                 {
-                    case JSON_STRING:
-                        _set_element(array, i, element.data.s, element.type);
-                        // Strings are stored in the parser's buffer, so they need to popped.
-                        parser->buffer = pop_ptr(&parser->jsonBufferStack);
-                        break;
-                    case JSON_OBJECT:
-                        _set_element(array, i, element.data.o, element.type);
-                        break;
-                    case JSON_ARRAY:
-                        _set_element(array, i, element.data.a, element.type);
-                        break;
-                    default:
-                        _set_element(array, i, &element.data, element.type);
-                        break;
+                    c->failed = true;
                 }
             }
-            parser->arrayBuffer = firstElement;
+            break;
+        }
+        default:
+            break;
+    }
+}
 
-            enum JsonDeserializeTypes type = peek_int(&parser->jsonDeserializeStack);
-            if (type == Deserialize_JsonObject)
+// Copies a chain of siblings, and everything below them. Returns the offset of the
+// first copy in the destination.
+u_int16_t _copy_JsonNode(_Copier * c, u_int16_t offset, JsonAllocKind kind, u_int8_t * base)
+{
+    u_int16_t first = DEFAULT_OBJECT_ADDRESS;
+    u_int16_t * link = &first;
+    while (offset != DEFAULT_OBJECT_ADDRESS && !c->failed)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        JsonNode * copy = _pool_alloc(c->destination, sizeof(JsonNode), alignof(JsonNode), kind);
+        if (!copy)
+        {
+            c->failed = true;
+            break;
+        }
+        _set_default_JsonNode(copy);
+        copy->letter = node->letter;
+        *link = (u_int8_t *) copy - c->destination->start;
+
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            JsonSlot * slotCopy = _pool_alloc(c->destination, sizeof(JsonSlot), alignof(JsonSlot), JSON_ALLOC_VALUE);
+            if (!slotCopy)
             {
-                JsonObject* parent = peek_ptr(&parser->jsonObjectStack);
-                parser->buffer = pop_ptr(&parser->jsonBufferStack);
-                _set_value(parent, parser->buffer, array, JSON_ARRAY);
+                c->failed = true;
+                break;
             }
-            else if (type == Deserialize_JsonArray)
+            JsonValue value = _slot_get((JsonSlot *)(base + node->data));
+            JsonValue valueCopy;
+            _copy_JsonValue(c, &value, &valueCopy);
+            if (c->failed || !_slot_set(slotCopy, valueCopy, c->destination))
             {
-                JsonValue * element = parser->arrayBuffer++;
-                element->type = JSON_ARRAY;
-                element->data.a = array;
+                c->failed = true;
+                break;
             }
+            copy->data = (u_int8_t *) slotCopy - c->destination->start;
+        }
+        copy->child = _copy_JsonNode(c, node->child, JSON_ALLOC_NODE, base);
 
-            next_token(parser);
-            return true;
-        default:
-            push_int(&parser->jsonParseStack, Parse_JsonElementSeparator);
-            push_int(&parser->jsonParseStack, Parse_JsonValue);
-            return true;
+        link = &(copy->sibling);
+        offset = node->sibling;
+        kind = JSON_ALLOC_NODE;
     }
+
+    return first;
 }
 
-bool parse_JsonMembers(_Parser* parser)
+// Shaped objects get a trie of their own in the copy.
+u_int16_t _copy_JsonObject(_Copier * c, JsonObject * obj)
 {
-    #ifdef DEBUG_JSON
-    printf("Parsing members\n");
-    #endif
-    skip_whitespace(parser);
-    switch (*(parser->input))
+    u_int8_t * base;
+    u_int16_t trie = _key_trie(obj, &base);
+    return _copy_JsonNode(c, trie, JSON_ALLOC_OBJECT, base);
+}
+
+JsonObject * clone_into(JsonMempool * destination, JsonObject * obj)
+{
+    _Extent extent = { .low = (u_int8_t *) obj, .high = (u_int8_t *) obj, .reachable = 0 };
+    _extent_JsonObject(&extent, obj);
+
+    // Keep the copy at the same alignment as the original.
+    u_int8_t * low = (u_int8_t *)((uintptr_t) extent.low & ~(uintptr_t)(alignof(JsonSlot) - 1));
+    size_t span = extent.high - low;
+    if (span <= 2 * extent.reachable)
     {
-        case '}':
-            pop_int(&parser->jsonDeserializeStack);
-            pop_int(&parser->jsonParseStack);
-            if (parser->jsonObjectStack.stacktop > 0)
+        u_int8_t * copy = _pool_alloc(destination, span, alignof(JsonSlot), JSON_ALLOC_BULK);
+        if (!copy)
+        {
+            return NULL;
+        }
+        memcpy(copy, low, span);
+
+        _Relocation r = { .low = low, .copy = copy, .destination = destination, .failed = false };
+        _relocate_JsonObject(&r, obj);
+        return r.failed ? NULL : _relocate(&r, obj);
+    }
+
+    _Copier c = { .destination = destination, .failed = false };
+    u_int16_t copy = _copy_JsonObject(&c, obj);
+    return c.failed ? NULL : (JsonObject *)(destination->start + copy);
+}
+
+// Freezing lays a finished object out again for reading. Each chain of siblings
+// is one run of nodes, followed by the value hanging off it, then the chains
+// below it. Strings are packed together after the tree.
+
+typedef struct _Freezer
+{
+    uintptr_t tree;
+    uintptr_t strings;
+    JsonMempool * destination;
+    bool failed;            // Set if a compact slot could not box an integer
+} _Freezer;
+
+void * _freeze_take(_Freezer * f, size_t size, size_t alignment)
+{
+    f->tree = (f->tree + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    void * p = (void *) f->tree;
+    f->tree += size;
+    return p;
+}
+
+void _measure_frozen_JsonNode(_Freezer * f, u_int16_t offset, u_int8_t * base);
+
+void _measure_frozen_JsonValue(_Freezer * f, JsonValue * value)
+{
+    switch (value->type)
+    {
+        case JSON_STRING:
+            if (!(value->flags & JSON_VALUE_INLINE))
             {
-                JsonObject* child = pop_ptr(&parser->jsonObjectStack);
-                enum JsonDeserializeTypes type = peek_int(&parser->jsonDeserializeStack);
-                if (type == Deserialize_JsonObject)
-                {
-                    JsonObject* parent = peek_ptr(&parser->jsonObjectStack);
-                    parser->buffer = pop_ptr(&parser->jsonBufferStack);
-                    _set_value(parent, parser->buffer, child, JSON_OBJECT);
-                }
-                else if (type == Deserialize_JsonArray)
-                {
-                    JsonValue * element = parser->arrayBuffer++;
-                    element->type = JSON_OBJECT;
-                    element->data.o = child;
-                }
+                f->strings += strlen(value->data.s) + 1;
             }
-            next_token(parser);
-            return true;
-        case '"':
-            push_int(&parser->jsonParseStack, Parse_JsonValueSeparator);
-            push_int(&parser->jsonParseStack, Parse_JsonValue);
-            push_int(&parser->jsonParseStack, Parse_Colon);
-            push_int(&parser->jsonParseStack, Parse_JsonString);
-            next_token(parser);
-            return true;
+            break;
+        case JSON_OBJECT:
+        {
+            u_int8_t * base;
+            u_int16_t trie = _key_trie(value->data.o, &base);
+            _measure_frozen_JsonNode(f, trie, base);
+            break;
+        }
+        case JSON_ARRAY:
+        {
+            JsonArray * array = value->data.a;
+            JsonSlot * elements = (JsonSlot *)(buffer->start + array->elements);
+            _freeze_take(f, sizeof(JsonArray), alignof(JsonArray));
+            _freeze_take(f, sizeof(JsonSlot) * array->length, alignof(JsonSlot));
+            for (int i = 0; i < array->length; i++)
+            {
+                JsonValue element = _slot_get(&elements[i]);
+                _measure_frozen_JsonValue(f, &element);
+            }
+            break;
+        }
         default:
-            return false;
+            break;
     }
 }
 
-bool parse_EscapedChar(_Parser * parser)
+void _measure_frozen_JsonNode(_Freezer * f, u_int16_t offset, u_int8_t * base)
 {
-    #ifdef DEBUG_JSON
-    printf("Parsing escaped character\n");
-    #endif
-    next_token(parser);
-    switch (*(parser->input))
+    int count = 0;
+    JsonSlot * slot = NULL;
+    for (u_int16_t o = offset; o != DEFAULT_OBJECT_ADDRESS; count++)
     {
-        case '"':
-        *(parser->buffer++) = '\"';
+        JsonNode * node = (JsonNode *)(buffer->start + o);
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            slot = (JsonSlot *)(base + node->data);
+        }
+        o = node->sibling;
+    }
+
+    _freeze_take(f, sizeof(JsonNode) * count, alignof(JsonNode));
+    if (slot)
+    {
+        JsonValue value = _slot_get(slot);
+        _freeze_take(f, sizeof(JsonSlot), alignof(JsonSlot));
+        _measure_frozen_JsonValue(f, &value);
+    }
+
+    for (u_int16_t o = offset; o != DEFAULT_OBJECT_ADDRESS; )
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + o);
+        _measure_frozen_JsonNode(f, node->child, base);
+        o = node->sibling;
+    }
+}
+
+u_int16_t _freeze_JsonNode(_Freezer * f, u_int16_t offset, u_int8_t * base);
+
+// Compact slots box their large integers after the frozen block.
+void _freeze_JsonValue(_Freezer * f, JsonSlot * slot, JsonSlot * slotCopy)
+{
+    JsonValue value = _slot_get(slot);
+    JsonValue copy = value;
+    switch (value.type)
+    {
+        case JSON_STRING:
+        {
+            if (value.flags & JSON_VALUE_INLINE)
+            {
+                break;
+            }
+            size_t length = strlen(value.data.s) + 1;
+            copy.data.s = (char *) f->strings;
+            memcpy(copy.data.s, value.data.s, length);
+            f->strings += length;
             break;
-        case '\\':
-            *(parser->buffer++) = '\\';
+        }
+        case JSON_OBJECT:
+        {
+            u_int8_t * base;
+            u_int16_t trie = _key_trie(value.data.o, &base);
+            u_int16_t offset = _freeze_JsonNode(f, trie, base);
+            copy.data.o = (JsonObject *)(f->destination->start + offset);
             break;
-        case '/':
-            *(parser->buffer++) = '/';
+        }
+        case JSON_ARRAY:
+        {
+            JsonArray * array = value.data.a;
+            JsonArray * arrayCopy = _freeze_take(f, sizeof(JsonArray), alignof(JsonArray));
+            JsonSlot * elementsCopy = _freeze_take(f, sizeof(JsonSlot) * array->length, alignof(JsonSlot));
+            arrayCopy->length = array->length;
+            arrayCopy->elements = (u_int8_t *) elementsCopy - f->destination->start;
+            copy.data.a = arrayCopy;
+
+            JsonSlot * elements = (JsonSlot *)(buffer->start + array->elements);
+            for (int i = 0; i < array->length; i++)
+            {
+                _freeze_JsonValue(f, &elements[i], &elementsCopy[i]);
+            }
             break;
-        case 'b':
-            *(parser->buffer++) = '\b';
+        }
+        default:
             break;
-        case 'f':
-            *(parser->buffer++) = '\f';
+    }
+
+    if (!_slot_set(slotCopy, copy, f->destination))
+    {
+        f->failed = true;
+    }
+}
+
+// Lays out a chain of siblings and everything below it, in the same order it was
+// measured in. Returns the offset of the chain in the destination.
+u_int16_t _freeze_JsonNode(_Freezer * f, u_int16_t offset, u_int8_t * base)
+{
+    if (offset == DEFAULT_OBJECT_ADDRESS)
+    {
+        return offset;
+    }
+
+    int count = 0;
+    for (u_int16_t o = offset; o != DEFAULT_OBJECT_ADDRESS; count++)
+    {
+        o = ((JsonNode *)(buffer->start + o))->sibling;
+    }
+
+    JsonNode * copies = _freeze_take(f, sizeof(JsonNode) * count, alignof(JsonNode));
+    u_int16_t first = (u_int8_t *) copies - f->destination->start;
+    int i = 0;
+    for (u_int16_t o = offset; o != DEFAULT_OBJECT_ADDRESS; i++)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + o);
+        _set_default_JsonNode(&copies[i]);
+        copies[i].letter = node->letter;
+        if (i + 1 < count)
+        {
+            copies[i].sibling = first + (i + 1) * sizeof(JsonNode);
+        }
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            JsonSlot * slotCopy = _freeze_take(f, sizeof(JsonSlot), alignof(JsonSlot));
+            copies[i].data = (u_int8_t *) slotCopy - f->destination->start;
+            _freeze_JsonValue(f, (JsonSlot *)(base + node->data), slotCopy);
+        }
+        o = node->sibling;
+    }
+
+    i = 0;
+    for (u_int16_t o = offset; o != DEFAULT_OBJECT_ADDRESS; i++)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + o);
+        copies[i].child = _freeze_JsonNode(f, node->child, base);
+        o = node->sibling;
+    }
+
+    return first;
+}
+
+JsonObject * freeze(JsonMempool * destination, JsonObject * obj)
+{
+    // Shaped objects are frozen with a trie of their own.
+    u_int8_t * base;
+    u_int16_t root = _key_trie(obj, &base);
+    _Freezer f = { .tree = 0, .strings = 0, .destination = destination, .failed = false };
+    _measure_frozen_JsonNode(&f, root, base);
+
+    u_int8_t * block = _pool_alloc(destination, f.tree + f.strings, alignof(JsonSlot), JSON_ALLOC_BULK);
+    if (!block)
+    {
+        return NULL;
+    }
+
+    f.strings = (uintptr_t) block + f.tree;
+    f.tree = (uintptr_t) block;
+    u_int16_t frozen = _freeze_JsonNode(&f, root, base);
+    return f.failed ? NULL : (JsonObject *)(destination->start + frozen);
+}
+
+#define JSON_STACK_LENGTH 128
+typedef struct _Stack
+{
+    void* stack[JSON_STACK_LENGTH];
+    int stacktop;
+    bool overflowed;
+    #ifdef JSON_PROFILE
+    int peak;
+    #endif
+} _Stack;
+
+int push_ptr(_Stack* s, void* p)
+{
+    if (s->stacktop >= JSON_STACK_LENGTH - 1)
+    {
+        s->overflowed = true;
+        return -1;
+    }
+
+    (s->stacktop)++;
+    s->stack[s->stacktop] = p;
+
+    #ifdef JSON_PROFILE
+    if (s->stacktop > s->peak) s->peak = s->stacktop;
+    #endif
+
+    return 0;
+}
+
+int push_int(_Stack* s, int i)
+{
+    if (s->stacktop >= JSON_STACK_LENGTH - 1)
+    {
+        s->overflowed = true;
+        return -1;
+    }
+
+    (s->stacktop)++;
+    ((int *)s->stack)[s->stacktop] = i;
+
+    #ifdef JSON_PROFILE
+    if (s->stacktop > s->peak) s->peak = s->stacktop;
+    #endif
+
+    return 0;
+}
+
+void* pop_ptr(_Stack* s)
+{
+    void *rval = s->stack[s->stacktop];
+    (s->stacktop)--;
+
+    return rval;
+}
+
+void* peek_ptr(_Stack* s)
+{
+    void *rval = s->stack[s->stacktop];
+    return rval;
+}
+
+int pop_int(_Stack* s)
+{
+    int rval = ((int*)s->stack)[s->stacktop];
+    (s->stacktop)--;
+
+    return rval;
+}
+
+int peek_int(_Stack* s)
+{
+    int rval = ((int*)s->stack)[s->stacktop];
+    return rval;
+}
+
+// Sets the high bit of every byte of x that is zero, or less than n (n <= 128).
+// Bits above the first match can be spurious, which only matters for finding
+// which byte matched, not whether one did.
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define SWAR_HAS_ZERO(x) (((x) - SWAR_ONES) & ~(x) & SWAR_HIGHS)
+#define SWAR_HAS_LESS(x, n) (((x) - SWAR_ONES * (n)) & ~(x) & SWAR_HIGHS)
+// Set when any of the eight bytes is a quote, a backslash or a control character,
+// which are the bytes a JSON string can not hold as they are.
+#define SWAR_HAS_SPECIAL(x) (SWAR_HAS_ZERO((x) ^ (SWAR_ONES * '"')) | \
+                             SWAR_HAS_ZERO((x) ^ (SWAR_ONES * '\\')) | \
+                             SWAR_HAS_LESS(x, 0x20))
+// True when none of the eight bytes is special or belongs to a multi-byte character.
+#define SWAR_IS_PLAIN(x) (!(SWAR_HAS_SPECIAL(x) | ((x) & SWAR_HIGHS)))
+
+
+typedef struct _Dumper
+{
+    _Stack valstack;
+    _Stack bufend_stack;
+    _Stack objIndex_stack;
+    _Stack dump_stack;
+    _Stack keystart_stack;  // Where the keys of each open object start in key_buffer
+    _Stack base_stack;      // What the data offsets of each open object are relative to
+    char * destination;
+    char * key_buffer;
+    char * key_buffer_end;
+    int key_start;          // Where the keys of the next object dumped by _dump_JsonObject start
+} _Dumper;
+
+enum JsonDumpTypes
+{
+    Dump_JsonValue,
+    Dump_JsonObject,
+    Dump_JsonArray,
+    Dump_JsonObject_Key
+};
+
+char _JSON_NULL_STR[] = "null";
+char _JSON_FALSE_STR[] = "false";
+char _JSON_TRUE_STR[] = "true";
+
+void _dump_JsonObject(JsonObject *o, _Dumper* dumper);
+void _dump_JsonValue(JsonValue *value, _Dumper* dumper);
+void _dump_JsonArray(JsonArray *ary, _Dumper* dumper);
+void _dump_JsonObject_Key(_Dumper * dumper, int bufStart, int bufEnd);
+
+// Writes c as it must appear inside a JSON string, and returns the bytes written.
+size_t _dump_EscapedChar(char c, char * destination)
+{
+    static const char hex[] = "0123456789abcdef";
+    char escaped;
+    switch (c)
+    {
+        case '"':
+            escaped = '"';
+            break;
+        case '\\':
+            escaped = '\\';
+            break;
+        case '\b':
+            escaped = 'b';
+            break;
+        case '\f':
+            escaped = 'f';
+            break;
+        case '\n':
+            escaped = 'n';
+            break;
+        case '\r':
+            escaped = 'r';
+            break;
+        case '\t':
+            escaped = 't';
+            break;
+        default:
+            if ((unsigned char) c >= 0x20)
+            {
+                *destination = c;
+                return 1;
+            }
+
+            // Other control characters have no short form.
+            memcpy(destination, "\\u00", 4);
+            destination[4] = hex[(unsigned char) c >> 4];
+            destination[5] = hex[c & 0xF];
+            return 6;
+    }
+
+    destination[0] = '\\';
+    destination[1] = escaped;
+    return 2;
+}
+
+// Writes length bytes of str escaped, without quotes. Runs without special bytes
+// are found eight bytes at a time and copied as one block.
+size_t _dump_escaped(const char * str, size_t length, char * destination)
+{
+    char * start = destination;
+    const char * end = str + length;
+    while (true)
+    {
+        const char * run = str;
+        while (end - str >= 8)
+        {
+            u_int64_t chunk;
+            memcpy(&chunk, str, sizeof(chunk));
+            if (SWAR_HAS_SPECIAL(chunk))
+            {
+                break;
+            }
+            str += 8;
+        }
+        while (str < end && (unsigned char) *str >= 0x20 && *str != '"' && *str != '\\')
+        {
+            str++;
+        }
+
+        memcpy(destination, run, str - run);
+        destination += str - run;
+        if (str == end)
+        {
+            return destination - start;
+        }
+        destination += _dump_EscapedChar(*(str++), destination);
+    }
+}
+
+size_t dump_JsonString(char * str, char * destination)
+{
+    char * start = destination;
+    *(destination++) = '"';
+    destination += _dump_escaped(str, strlen(str), destination);
+    *(destination++) = '"';
+
+    return destination - start;
+}
+
+// Numbers are formatted on the side, since sprintf also writes a terminator,
+// which must not land on whatever follows the number.
+size_t dump_JsonFloat(float f, char * destination)
+{
+    char number[32];
+    int length = sprintf(number, "%g", f);
+    memcpy(destination, number, length);
+    return length;
+}
+
+static const char _digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Writes digits from the end, two at a time, to halve the number of divisions.
+size_t dump_JsonInt(int64_t i, char * destination)
+{
+    char digits[20];
+    char * d = digits + sizeof(digits);
+    u_int64_t magnitude = i < 0 ? -(u_int64_t) i : (u_int64_t) i;
+    while (magnitude >= 100)
+    {
+        d -= 2;
+        memcpy(d, _digit_pairs + magnitude % 100 * 2, 2);
+        magnitude /= 100;
+    }
+    if (magnitude >= 10)
+    {
+        d -= 2;
+        memcpy(d, _digit_pairs + magnitude * 2, 2);
+    }
+    else
+    {
+        *(--d) = '0' + magnitude;
+    }
+
+    char * start = destination;
+    if (i < 0)
+    {
+        *(destination++) = '-';
+    }
+    size_t length = digits + sizeof(digits) - d;
+    memcpy(destination, d, length);
+    return destination + length - start;
+}
+
+// Uses the fewest significant digits, from 15 to 17, that read back as the same
+// double. JSON has no infinities or NaN, so those are written as null.
+size_t dump_JsonDouble(double d, char * destination)
+{
+    if (d != d || d - d != 0)
+    {
+        memcpy(destination, "null", 4);
+        return 4;
+    }
+
+    char number[32];
+    int length = 0;
+    for (int precision = 15; precision <= 17; precision++)
+    {
+        length = sprintf(number, "%.*g", precision, d);
+        if (strtod(number, NULL) == d)
+        {
+            break;
+        }
+    }
+    memcpy(destination, number, length);
+    return length;
+}
+
+void _dump_JsonObject_Key(_Dumper * dumper, int bufStart, int bufEnd)
+{
+    *(dumper->destination++) = '"'; 
+    dumper->destination += _dump_escaped(dumper->key_buffer + bufStart, bufEnd - bufStart + 1, dumper->destination);
+    *(dumper->destination++) = '"'; 
+    *(dumper->destination++) = ':'; 
+}
+
+void _dump_JsonArray(JsonArray *ary, _Dumper* dumper)
+{
+    int key_start = dumper->key_start;
+    *(dumper->destination++) = '[';
+    for (int i = 0; i < ary->length; i++)
+    {
+        if (i > 0)
+        {
+            *(dumper->destination++) = ',';
+        }
+
+        JsonValue element = _slot_get(&((JsonSlot*)(buffer->start + ary->elements))[i]);
+        dumper->key_start = key_start;
+        switch (element.type)
+        {
+            case JSON_OBJECT:
+                _dump_JsonObject(element.data.o, dumper);
+                break;
+            default:
+                _dump_JsonValue(&element, dumper);
+                break;
+        }
+    }
+    *(dumper->destination++) = ']';
+}
+
+void _dump_JsonValue(JsonValue* value, _Dumper* dumper)
+{
+    switch (value->type)
+    {
+        char *str;
+        case JSON_NULL:
+            str = _JSON_NULL_STR;
+            while (*str) *(dumper->destination++) = *(str++);
+            break;
+        case JSON_STRING:
+            dumper->destination += dump_JsonString(get_string(value), dumper->destination);
+            break;
+        case JSON_BOOL:
+            str = value->data.b ? _JSON_TRUE_STR : _JSON_FALSE_STR;
+            while (*str) *(dumper->destination++) = *(str++);
+            break;
+        case JSON_FLOAT:
+            dumper->destination += dump_JsonFloat(value->data.f, dumper->destination);
+            break;
+        case JSON_INT:
+            dumper->destination += dump_JsonInt(value->data.i, dumper->destination);
+            break;
+        case JSON_DOUBLE:
+            dumper->destination += dump_JsonDouble(value->data.d, dumper->destination);
+            break;
+        case JSON_OBJECT:
+            _dump_JsonObject(value->data.o, dumper);
+            break;
+        case JSON_ARRAY:
+            _dump_JsonArray(value->data.a, dumper);
+            break;
+        default:
+            break;
+    }
+}
+
+// Starts dumping an object whose keys are written from keyStart in the key buffer.
+void _open_JsonObject(JsonObject * o, _Dumper * dumper, int keyStart)
+{
+    u_int8_t * base;
+    u_int16_t trie = _key_trie(o, &base);
+    push_int(&dumper->objIndex_stack, dumper->valstack.stacktop);
+    push_int(&dumper->keystart_stack, keyStart);
+    push_ptr(&dumper->base_stack, base);
+    push_ptr(&dumper->valstack, buffer->start + trie);
+    push_int(&dumper->bufend_stack, keyStart);
+    *(dumper->destination++) = '{';
+}
+
+// Dumps a value into a key buffer of its own, once the shared one runs out.
+void _dump_JsonValue_spilled(JsonValue * value, _Dumper * dumper)
+{
+    char key_buffer[JSON_KEY_LENGTH];
+    dumper->key_buffer = key_buffer;
+    dumper->key_buffer_end = key_buffer + JSON_KEY_LENGTH;
+    dumper->key_start = 0;
+    _dump_JsonValue(value, dumper);
+}
+
+void _dump_JsonObject(JsonObject *o, _Dumper * dumper)
+{
+    int intial_valstack_top = dumper->valstack.stacktop + 1;
+    int intial_objIndex_stack_top = dumper->objIndex_stack.stacktop + 1;
+    int keyStart = dumper->key_start;
+    _open_JsonObject(o, dumper, keyStart);
+    u_int8_t * base = peek_ptr(&dumper->base_stack);
+
+    while (dumper->valstack.stacktop >= intial_valstack_top)
+    {
+        JsonNode* node = pop_ptr(&dumper->valstack);
+        int strIndex  = pop_int(&dumper->bufend_stack);  // This will update strIndex
+        dumper->key_buffer[strIndex] = node->letter;  // Add the current key to the buffer
+
+        // Add sibling to stack if exists
+        if (node->sibling != DEFAULT_OBJECT_ADDRESS)
+        {
+            JsonNode* sibling = (JsonNode*)(buffer->start + node->sibling); 
+            push_ptr(&dumper->valstack, sibling);
+            push_int(&dumper->bufend_stack, strIndex);
+        }
+
+        // Add child to stack if exists
+        if (node->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            JsonNode* child = (JsonNode*)(buffer->start + node->child); 
+            push_ptr(&dumper->valstack, child);
+            push_int(&dumper->bufend_stack, strIndex + 1);
+        }
+
+        // Print current node if it's not empty
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            if (*(dumper->destination - 1) != '{')
+            {
+                *(dumper->destination++) = ',';
+            }
+
+            _dump_JsonObject_Key(dumper, keyStart, strIndex - 1);
+            JsonValue value = _slot_get((JsonSlot*)(base + node->data));
+            if (value.type != JSON_OBJECT && value.type != JSON_ARRAY)
+            {
+                _dump_JsonValue(&value, dumper);
+            }
+            // Keys inside the value are written just past this one, so the keys
+            // that follow it still find their prefix in the buffer
+            else if (dumper->key_buffer + strIndex + 1 + JSON_KEY_LENGTH > dumper->key_buffer_end)
+            {
+                char * outer_key_buffer = dumper->key_buffer;
+                char * outer_key_buffer_end = dumper->key_buffer_end;
+                _dump_JsonValue_spilled(&value, dumper);
+                dumper->key_buffer = outer_key_buffer;
+                dumper->key_buffer_end = outer_key_buffer_end;
+            }
+            else if (value.type == JSON_OBJECT)
+            {
+                keyStart = strIndex + 1;
+                _open_JsonObject(value.data.o, dumper, keyStart);
+                base = peek_ptr(&dumper->base_stack);
+            }
+            else
+            {
+                dumper->key_start = strIndex + 1;
+                _dump_JsonArray(value.data.a, dumper);
+            }
+        }
+
+        // Close every object whose nodes have all been dumped
+        if (dumper->valstack.stacktop == peek_int(&dumper->objIndex_stack))
+        {
+            do
+            {
+                *(dumper->destination++) = '}';
+                pop_int(&dumper->objIndex_stack);
+                pop_int(&dumper->keystart_stack);
+                pop_ptr(&dumper->base_stack);
+            } while (dumper->objIndex_stack.stacktop >= intial_objIndex_stack_top &&
+                     dumper->valstack.stacktop == peek_int(&dumper->objIndex_stack));
+            if (dumper->objIndex_stack.stacktop >= intial_objIndex_stack_top)
+            {
+                keyStart = peek_int(&dumper->keystart_stack);
+                base = peek_ptr(&dumper->base_stack);
+            }
+        }
+    }
+}
+
+void _init_dumper(_Dumper * dumper, char * key_buffer, size_t size, char * destination)
+{
+    dumper->key_buffer = key_buffer;
+    dumper->key_buffer_end = key_buffer + size;
+    dumper->destination = destination;
+    dumper->key_start = 0;
+    dumper->valstack.stacktop = -1;
+    dumper->bufend_stack.stacktop = -1;
+    dumper->objIndex_stack.stacktop = -1;
+    dumper->keystart_stack.stacktop = -1;
+    dumper->base_stack.stacktop = -1;
+}
+
+size_t dump_JsonObject(JsonObject* o, char* destination)
+{
+    char key_buffer[JSON_KEY_LENGTH * 4];
+    _Dumper dumper;
+    _init_dumper(&dumper, key_buffer, sizeof(key_buffer), destination);
+
+    _dump_JsonObject(o, &dumper);
+    *(dumper.destination) = '\0';
+    
+    return dumper.destination - destination;
+}
+
+// Parallel dumping. The members or elements of the largest container near the
+// root are split into one slice per thread. Each thread first measures how many
+// bytes the chunks of its slice dump to, without writing anything. The chunks are
+// then regrouped into slices of about the same number of bytes, so each one knows
+// where its output starts, and the threads dump their slices straight into the
+// destination.
+
+// Counts the bytes _dump_escaped writes for length bytes of str.
+size_t _measure_escaped(const char * str, size_t length)
+{
+    size_t size = length;
+    const char * end = str + length;
+    while (str < end)
+    {
+        if (end - str >= 8)
+        {
+            u_int64_t chunk;
+            memcpy(&chunk, str, sizeof(chunk));
+            if (!SWAR_HAS_SPECIAL(chunk))
+            {
+                str += 8;
+                continue;
+            }
+        }
+
+        unsigned char c = *(str++);
+        if (c == '"' || c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t')
+        {
+            size += 1;
+        }
+        else if (c < 0x20)
+        {
+            size += 5;
+        }
+    }
+    return size;
+}
+
+size_t _measure_JsonObject(JsonObject * o);
+
+// Counts the bytes _dump_JsonValue writes for value.
+size_t _measure_JsonValue(JsonValue * value)
+{
+    char number[32];
+    switch (value->type)
+    {
+        case JSON_NULL:
+            return 4;
+        case JSON_STRING:
+        {
+            char * str = get_string(value);
+            return 2 + _measure_escaped(str, strlen(str));
+        }
+        case JSON_BOOL:
+            return value->data.b ? 4 : 5;
+        case JSON_FLOAT:
+            return dump_JsonFloat(value->data.f, number);
+        case JSON_INT:
+            return dump_JsonInt(value->data.i, number);
+        case JSON_DOUBLE:
+            return dump_JsonDouble(value->data.d, number);
+        case JSON_OBJECT:
+            return _measure_JsonObject(value->data.o);
+        case JSON_ARRAY:
+        {
+            JsonArray * ary = value->data.a;
+            size_t size = ary->length > 0 ? 1 + ary->length : 2;
+            for (int i = 0; i < ary->length; i++)
+            {
+                JsonValue element = _slot_get(&((JsonSlot*)(buffer->start + ary->elements))[i]);
+                size += _measure_JsonValue(&element);
+            }
+            return size;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Adds up the members hanging off the chain at offset and below it, walking the
+// trie like _dump_JsonObject does. Every key in the chain starts with a prefix
+// that dumps to keySize bytes. Escaping works byte by byte, so the key sizes
+// add up letter by letter and keys of any length are measured.
+size_t _measure_JsonNode(u_int16_t offset, u_int8_t * base, size_t keySize, size_t * count)
+{
+    size_t size = 0;
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode*)(buffer->start + offset);
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            JsonValue value = _slot_get((JsonSlot*)(base + node->data));
+            size += 3 + keySize + _measure_JsonValue(&value);
+            (*count)++;
+        }
+        if (node->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            size += _measure_JsonNode(node->child, base, keySize + _measure_escaped((char *) &node->letter, 1), count);
+        }
+        offset = node->sibling;
+    }
+    return size;
+}
+
+size_t _measure_JsonObject(JsonObject * o)
+{
+    u_int8_t * base;
+    u_int16_t trie = _key_trie(o, &base);
+    size_t count = 0;
+    size_t size = 2 + _measure_JsonNode(trie, base, 0, &count);
+    return size + (count > 0 ? count - 1 : 0);
+}
+
+// Counts the members hanging off the chain at offset and below it.
+size_t _count_JsonNode(u_int16_t offset)
+{
+    size_t count = 0;
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode*)(buffer->start + offset);
+        count += node->data != DEFAULT_OBJECT_ADDRESS;
+        if (node->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            count += _count_JsonNode(node->child);
+        }
+        offset = node->sibling;
+    }
+    return count;
+}
+
+// Finds the first member the dumper writes from the chain at offset, with its
+// key written from depth in a key buffer of size bytes. Returns the length of
+// the key, or -1 if there is no member or its key does not fit.
+int _first_JsonNode(u_int16_t offset, u_int8_t * base, char * key_buffer, int size, int depth, JsonValue * value)
+{
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode*)(buffer->start + offset);
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            *value = _slot_get((JsonSlot*)(base + node->data));
+            return depth;
+        }
+        if (node->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            if (depth >= size)
+            {
+                return -1;
+            }
+            key_buffer[depth] = node->letter;
+            int length = _first_JsonNode(node->child, base, key_buffer, size, depth + 1, value);
+            if (length >= 0)
+            {
+                return length;
+            }
+        }
+        offset = node->sibling;
+    }
+    return -1;
+}
+
+#define JSON_DUMP_CHUNKS 8
+
+typedef struct _DumpSlice
+{
+    JsonValue container;            // The array or object whose slice this is
+    u_int16_t first;                // Index of the first element or member
+    u_int16_t count;                // Number of elements or members
+    bool measuring;
+    size_t size;                    // Bytes written, including the comma before the slice
+    size_t chunks[JSON_DUMP_CHUNKS];// Bytes measured for each chunk of the slice
+    char * destination;
+    int depth;                      // Where path ends, or -1 to walk the trie from its root
+    u_int16_t path[JSON_KEY_LENGTH];// The nodes the slice's first member hangs off, one per depth
+} _DumpSlice;
+
+// Chunks split a slice being measured by count.
+u_int32_t _chunk_start(_DumpSlice * slice, int chunk)
+{
+    return slice->first + (u_int32_t) slice->count * chunk / JSON_DUMP_CHUNKS;
+}
+
+// An object's slice is walked in the dumper's order from the node of its first
+// member, or from the root of the trie, counting the members on the way.
+typedef struct _SliceWalk
+{
+    _DumpSlice * slice;
+    _Dumper dumper;
+    u_int8_t * base;
+    u_int32_t index;                // Members walked past so far
+    int chunk;                      // The chunk index is in, while measuring
+    size_t size;
+} _SliceWalk;
+
+void _add_SliceSize(_SliceWalk * walk, size_t size)
+{
+    while (walk->chunk + 1 < JSON_DUMP_CHUNKS && walk->index >= _chunk_start(walk->slice, walk->chunk + 1))
+    {
+        walk->chunk++;
+    }
+    walk->slice->chunks[walk->chunk] += size;
+    walk->size += size;
+}
+
+// Measures or dumps a member of an object's slice, whose key is the first
+// length bytes of the key buffer.
+void _dump_SliceMember(_SliceWalk * walk, int length, JsonValue * value)
+{
+    _Dumper * dumper = &walk->dumper;
+    if (walk->slice->measuring)
+    {
+        _add_SliceSize(walk, (walk->index > 0) + 3 + _measure_escaped(dumper->key_buffer, length) + _measure_JsonValue(value));
+        return;
+    }
+
+    if (walk->index > 0)
+    {
+        *(dumper->destination++) = ',';
+    }
+    _dump_JsonObject_Key(dumper, 0, length - 1);
+    if (value->type != JSON_OBJECT && value->type != JSON_ARRAY)
+    {
+        _dump_JsonValue(value, dumper);
+    }
+    else if (dumper->key_buffer + length + 1 + JSON_KEY_LENGTH > dumper->key_buffer_end)
+    {
+        char * outer_key_buffer = dumper->key_buffer;
+        char * outer_key_buffer_end = dumper->key_buffer_end;
+        _dump_JsonValue_spilled(value, dumper);
+        dumper->key_buffer = outer_key_buffer;
+        dumper->key_buffer_end = outer_key_buffer_end;
+    }
+    else
+    {
+        dumper->key_start = length + 1;
+        _dump_JsonValue(value, dumper);
+    }
+}
+
+// Walks the chain at offset, whose letters go at depth in the key buffer, and
+// the chains below it. Returns false once the slice's last member is done.
+bool _walk_DumpSlice(_SliceWalk * walk, u_int16_t offset, int depth)
+{
+    _Dumper * dumper = &walk->dumper;
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode*)(buffer->start + offset);
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            if (walk->index >= (u_int32_t) walk->slice->first + walk->slice->count)
+            {
+                return false;
+            }
+            if (walk->index >= walk->slice->first)
+            {
+                JsonValue value = _slot_get((JsonSlot*)(walk->base + node->data));
+                _dump_SliceMember(walk, depth, &value);
+            }
+            walk->index++;
+        }
+        if (node->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            // Like the dumper, a key never runs past the end of the key buffer
+            if (dumper->key_buffer + depth + 1 >= dumper->key_buffer_end)
+            {
+                return false;
+            }
+            dumper->key_buffer[depth] = node->letter;
+            if (!_walk_DumpSlice(walk, node->child, depth + 1))
+            {
+                return false;
+            }
+        }
+        offset = node->sibling;
+    }
+    return true;
+}
+
+// Measures or dumps a slice, with a comma in front of every element or member
+// but the container's first.
+void * _run_DumpSlice(void * argument)
+{
+    _DumpSlice * slice = argument;
+    char key_buffer[JSON_KEY_LENGTH * 4];
+    _SliceWalk walk = { .slice = slice, .index = 0, .chunk = 0, .size = 0 };
+    _Dumper * dumper = &walk.dumper;
+    _init_dumper(dumper, key_buffer, sizeof(key_buffer), slice->destination);
+    memset(slice->chunks, 0, sizeof(slice->chunks));
+
+    if (slice->container.type == JSON_OBJECT)
+    {
+        u_int16_t trie = _key_trie(slice->container.data.o, &walk.base);
+        if (slice->depth < 0)
+        {
+            _walk_DumpSlice(&walk, trie, 0);
+        }
+        else
+        {
+            // Goes on from the first member's node, then from the siblings of each
+            // node above it, as the walk from the root would have.
+            for (int depth = 0; depth < slice->depth; depth++)
+            {
+                key_buffer[depth] = ((JsonNode*)(buffer->start + slice->path[depth]))->letter;
+            }
+            walk.index = slice->first;
+            bool more = _walk_DumpSlice(&walk, slice->path[slice->depth], slice->depth);
+            for (int depth = slice->depth - 1; more && depth >= 0; depth--)
+            {
+                more = _walk_DumpSlice(&walk, ((JsonNode*)(buffer->start + slice->path[depth]))->sibling, depth);
+            }
+        }
+    }
+    else
+    {
+        JsonArray * ary = slice->container.data.a;
+        for (u_int16_t i = 0; i < slice->count; i++)
+        {
+            JsonValue value = _slot_get(&((JsonSlot*)(buffer->start + ary->elements))[slice->first + i]);
+            if (slice->measuring)
+            {
+                walk.index = slice->first + i;
+                _add_SliceSize(&walk, (slice->first + i > 0) + _measure_JsonValue(&value));
+                continue;
+            }
+            if (slice->first + i > 0)
+            {
+                *(dumper->destination++) = ',';
+            }
+            _dump_JsonValue(&value, dumper);
+        }
+    }
+
+    slice->size = slice->measuring ? walk.size : (size_t)(dumper->destination - slice->destination);
+    return NULL;
+}
+
+// Finds the nodes each slice of an object starts from, for all the slices in one
+// walk of its trie. Slices whose first member has a key too long for a path are
+// walked from the root instead.
+typedef struct _PathWalk
+{
+    _DumpSlice * slices;
+    int nSlices;
+    int next;                       // The first slice whose path is still to be found
+    u_int32_t index;                // Members walked past so far
+    u_int16_t path[JSON_KEY_LENGTH];
+} _PathWalk;
+
+bool _walk_SlicePaths(_PathWalk * walk, u_int16_t offset, int depth)
+{
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode*)(buffer->start + offset);
+        walk->path[depth] = offset;
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            while (walk->slices[walk->next].first < walk->index)
+            {
+                if (++walk->next == walk->nSlices) return false;
+            }
+            _DumpSlice * slice = &walk->slices[walk->next];
+            if (slice->first == walk->index)
+            {
+                slice->depth = depth;
+                memcpy(slice->path, walk->path, (depth + 1) * sizeof(u_int16_t));
+                if (++walk->next == walk->nSlices) return false;
+            }
+            walk->index++;
+        }
+        if (node->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            if (depth + 1 >= JSON_KEY_LENGTH)
+            {
+                walk->index += _count_JsonNode(node->child);
+            }
+            else if (!_walk_SlicePaths(walk, node->child, depth + 1))
+            {
+                return false;
+            }
+        }
+        offset = node->sibling;
+    }
+    return true;
+}
+
+void _find_SlicePaths(_DumpSlice * slices, int nSlices)
+{
+    for (int i = 0; i < nSlices; i++)
+    {
+        slices[i].depth = -1;
+    }
+    if (slices[0].container.type == JSON_OBJECT)
+    {
+        u_int8_t * base;
+        _PathWalk walk = { .slices = slices, .nSlices = nSlices, .next = 0, .index = 0 };
+        _walk_SlicePaths(&walk, _key_trie(slices[0].container.data.o, &base), 0);
+    }
+}
+
+// Runs run on each of the nSlices slices of size bytes, on a thread of its own but
+// for the first, which runs on the calling thread. Slices whose thread cannot be
+// started run on the calling thread too.
+void _run_slices(void * (*run)(void *), void * slices, size_t size, int nSlices)
+{
+    pthread_t threads[JSON_DUMP_THREADS > JSON_PARSE_THREADS ? JSON_DUMP_THREADS : JSON_PARSE_THREADS];
+    bool started[JSON_DUMP_THREADS > JSON_PARSE_THREADS ? JSON_DUMP_THREADS : JSON_PARSE_THREADS];
+    for (int i = 1; i < nSlices; i++)
+    {
+        started[i] = pthread_create(&threads[i], NULL, run, (char *) slices + i * size) == 0;
+    }
+    run(slices);
+    for (int i = 1; i < nSlices; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+        else
+        {
+            run((char *) slices + i * size);
+        }
+    }
+}
+
+size_t dump_JsonObject_parallel(JsonObject * o, char * destination, int nThreads)
+{
+    if (nThreads > JSON_DUMP_THREADS)
+    {
+        nThreads = JSON_DUMP_THREADS;
+    }
+
+    // Objects with a single member are opened in front of the slices, until the
+    // container to split is reached.
+    char * d = destination;
+    char key_buffer[JSON_KEY_LENGTH * 4];
+    int closers = 0;
+    JsonValue container = { .type = JSON_OBJECT, .data.o = o };
+    size_t count = 0;
+    while (container.type == JSON_OBJECT && closers < JSON_STACK_LENGTH)
+    {
+        u_int8_t * base;
+        u_int16_t trie = _key_trie(container.data.o, &base);
+        count = _count_JsonNode(trie);
+        JsonValue only;
+        int length = count == 1 ? _first_JsonNode(trie, base, key_buffer, sizeof(key_buffer), 0, &only) : -1;
+        if (length < 0 || (only.type != JSON_OBJECT && only.type != JSON_ARRAY))
+        {
+            break;
+        }
+
+        *(d++) = '{';
+        *(d++) = '"';
+        d += _dump_escaped(key_buffer, length, d);
+        *(d++) = '"';
+        *(d++) = ':';
+        closers++;
+        container = only;
+    }
+
+    if (container.type == JSON_ARRAY)
+    {
+        count = container.data.a->length;
+    }
+
+    int nSlices = nThreads < (int) count ? nThreads : (int) count;
+    if (nSlices < 2)
+    {
+        return dump_JsonObject(o, destination);
+    }
+
+    // Slices are measured split by count, a chunk at a time.
+    _DumpSlice slices[JSON_DUMP_THREADS];
+    for (int i = 0; i < nSlices; i++)
+    {
+        _DumpSlice * slice = &slices[i];
+        slice->container = container;
+        slice->first = (u_int32_t) count * i / nSlices;
+        slice->count = (u_int32_t) count * (i + 1) / nSlices - slice->first;
+        slice->measuring = true;
+    }
+    _find_SlicePaths(slices, nSlices);
+    _run_slices(_run_DumpSlice, slices, sizeof(_DumpSlice), nSlices);
+
+    // Then they are cut again between chunks, once a slice has its share of the bytes.
+    u_int32_t starts[JSON_DUMP_THREADS * JSON_DUMP_CHUNKS];
+    size_t sizes[JSON_DUMP_THREADS * JSON_DUMP_CHUNKS];
+    size_t total = 0;
+    int nChunks = 0;
+    for (int i = 0; i < nSlices; i++)
+    {
+        for (int j = 0; j < JSON_DUMP_CHUNKS; j++, nChunks++)
+        {
+            starts[nChunks] = _chunk_start(&slices[i], j);
+            sizes[nChunks] = slices[i].chunks[j];
+            total += sizes[nChunks];
+        }
+    }
+
+    int nCut = 0;
+    size_t written = 0;
+    for (int j = 0; j < nChunks; j++)
+    {
+        if (nCut == 0 || (written >= total * nCut / nSlices && starts[j] > slices[nCut - 1].first))
+        {
+            slices[nCut].first = starts[j];
+            slices[nCut].size = 0;
+            nCut++;
+        }
+        slices[nCut - 1].size += sizes[j];
+        written += sizes[j];
+    }
+
+    char open = container.type == JSON_OBJECT ? '{' : '[';
+    *(d++) = open;
+    for (int i = 0; i < nCut; i++)
+    {
+        slices[i].count = (i + 1 < nCut ? slices[i + 1].first : count) - slices[i].first;
+        slices[i].destination = d;
+        slices[i].measuring = false;
+        d += slices[i].size;
+    }
+    _find_SlicePaths(slices, nCut);
+    _run_slices(_run_DumpSlice, slices, sizeof(_DumpSlice), nCut);
+
+    *(d++) = open == '{' ? '}' : ']';
+    while (closers-- > 0)
+    {
+        *(d++) = '}';
+    }
+    *d = '\0';
+    return d - destination;
+}
+
+void skip_JsonWhitespace(char ** input)
+{
+    while (**input)
+    {
+        switch (**input)
+        {
+            case ' ':
+            case '\r':
+            case '\t':
+            case '\n':
+                break;
+            default:
+                return;
+        }
+        (*input)++;
+    }
+}
+
+// Reads four hex digits into code. Stops at anything else, including a terminator.
+bool _scan_hex4(const char * c, u_int32_t * code)
+{
+    *code = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        char digit = c[i];
+        *code <<= 4;
+        if (digit >= '0' && digit <= '9') *code |= digit - '0';
+        else if (digit >= 'a' && digit <= 'f') *code |= digit - 'a' + 10;
+        else if (digit >= 'A' && digit <= 'F') *code |= digit - 'A' + 10;
+        else return false;
+    }
+    return true;
+}
+
+// Writes the code point as UTF-8 and returns the number of bytes written.
+int _encode_Utf8(u_int32_t code, char * destination)
+{
+    unsigned char * d = (unsigned char *) destination;
+    if (code < 0x80)
+    {
+        d[0] = code;
+        return 1;
+    }
+    else if (code < 0x800)
+    {
+        d[0] = 0xC0 | (code >> 6);
+        d[1] = 0x80 | (code & 0x3F);
+        return 2;
+    }
+    else if (code < 0x10000)
+    {
+        d[0] = 0xE0 | (code >> 12);
+        d[1] = 0x80 | ((code >> 6) & 0x3F);
+        d[2] = 0x80 | (code & 0x3F);
+        return 3;
+    }
+    d[0] = 0xF0 | (code >> 18);
+    d[1] = 0x80 | ((code >> 12) & 0x3F);
+    d[2] = 0x80 | ((code >> 6) & 0x3F);
+    d[3] = 0x80 | (code & 0x3F);
+    return 4;
+}
+
+// Returns the length of the UTF-8 sequence at c, or 0 if it is truncated by end,
+// overlong, a surrogate or above U+10FFFF. Bytes are checked in order, so on
+// terminated input a terminator stops the check before anything past it is read.
+int _match_Utf8(const unsigned char * c, const unsigned char * end)
+{
+    int length;
+    unsigned char low = 0x80, high = 0xBF;
+    if (*c < 0x80)
+    {
+        return 1;
+    }
+    else if (*c < 0xC2)
+    {
+        return 0;
+    }
+    else if (*c < 0xE0)
+    {
+        length = 2;
+    }
+    else if (*c < 0xF0)
+    {
+        length = 3;
+        if (*c == 0xE0) low = 0xA0;
+        if (*c == 0xED) high = 0x9F;
+    }
+    else if (*c < 0xF5)
+    {
+        length = 4;
+        if (*c == 0xF0) low = 0x90;
+        if (*c == 0xF4) high = 0x8F;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (end - c < length || c[1] < low || c[1] > high)
+    {
+        return 0;
+    }
+    for (int i = 2; i < length; i++)
+    {
+        if ((c[i] & 0xC0) != 0x80) return 0;
+    }
+    return length;
+}
+
+bool _scan_EscapedChar(char ** input, char ** destination);
+
+bool scan_JsonString(char ** input, char * destination, size_t size)
+{
+    if (**input != '"')
+    {
+        return false;
+    }
+
+    char * end = destination + size - 1;
+    char * c = *input + 1;
+    while (*c)
+    {
+        if (*c == '"')
+        {
+            *destination = '\0';
+            *input = c + 1;
+            return true;
+        }
+
+        // Escapes and multi-byte characters both come out as up to four bytes.
+        char decoded[4];
+        char * from = c;
+        int length = 1;
+        if (*c == '\\')
+        {
+            char * d = decoded;
+            if (!_scan_EscapedChar(&c, &d))
+            {
+                return false;
+            }
+            from = decoded;
+            length = d - decoded;
+        }
+        else if ((unsigned char) *c < 0x20)
+        {
+            return false;
+        }
+        else if ((unsigned char) *c >= 0x80)
+        {
+            length = _match_Utf8((unsigned char *) c, (unsigned char *) c + 4);
+            if (!length)
+            {
+                return false;
+            }
+            c += length - 1;
+        }
+
+        if (end - destination < length)
+        {
+            return false;
+        }
+        memcpy(destination, from, length);
+        destination += length;
+        c++;
+    }
+
+    return false;
+}
+
+const char * _match_JsonNumber(const char * c, const char * end);
+const char * _match_JsonFraction(const char * c, const char * end);
+
+// strtod also reads hex, infinities, leading zeros and a leading '+', so what it
+// read has to be one number of the JSON grammar, which strtod reads all of.
+bool _strtod_JsonNumber(char ** input, double * value)
+{
+    char * end = *input;
+    *value = strtod(*input, &end);
+    if (end == *input || _match_JsonNumber(*input, end) != end)
+    {
+        return false;
+    }
+
+    *input = end;
+    return true;
+}
+
+bool scan_JsonNumber(char ** input, float * value)
+{
+    double d;
+    if (!_strtod_JsonNumber(input, &d))
+    {
+        return false;
+    }
+
+    *value = d;
+    return true;
+}
+
+// Reads a number as JSON_INT when it has no fraction or exponent and fits in 64
+// bits, accumulating the digits directly. Anything else is left to strtod.
+bool _scan_JsonNumber_value(char ** input, JsonValue * value)
+{
+    char * c = *input;
+    bool negative = *c == '-';
+    c += negative;
+
+    // Up to 19 digits always fit in 64 unsigned bits.
+    char * digits = c;
+    u_int64_t magnitude = 0;
+    while (*c >= '0' && *c <= '9' && c - digits < 19)
+    {
+        magnitude = magnitude * 10 + (*c - '0');
+        c++;
+    }
+
+    if (c > digits && *c != '.' && *c != 'e' && *c != 'E' && !(*c >= '0' && *c <= '9') &&
+        !(*digits == '0' && c - digits > 1) && magnitude <= (u_int64_t) INT64_MAX + negative)
+    {
+        value->type = JSON_INT;
+        value->data.i = negative ? (int64_t) -magnitude : (int64_t) magnitude;
+        *input = c;
+        return true;
+    }
+
+    // Digits were read up to here, so only a fraction and an exponent are left to
+    // check in what strtod read.
+    char * end = *input;
+    if (c == digits || (*digits == '0' && c - digits > 1))
+    {
+        return false;
+    }
+    value->type = JSON_DOUBLE;
+    value->data.d = strtod(*input, &end);
+    if (*digits != '0')
+    {
+        while (c < end && *c >= '0' && *c <= '9') c++;
+    }
+    if (_match_JsonFraction(c, end) != end)
+    {
+        return false;
+    }
+
+    *input = end;
+    return true;
+}
+
+bool scan_JsonInt(char ** input, int64_t * value)
+{
+    char * c = *input;
+    JsonValue v;
+    if (!_scan_JsonNumber_value(&c, &v) || v.type != JSON_INT)
+    {
+        return false;
+    }
+
+    *value = v.data.i;
+    *input = c;
+    return true;
+}
+
+bool scan_JsonDouble(char ** input, double * value)
+{
+    return _strtod_JsonNumber(input, value);
+}
+
+bool skip_JsonValue(char ** input)
+{
+    char * c = *input;
+    int depth = 0;
+    switch (*c)
+    {
+        case '"':
+        case '{':
+        case '[':
+            break;
+        default:
+            // Scalars run until the next delimiter.
+            while (*c && !strchr(",:]} \r\t\n", *c)) c++;
+            if (c == *input)
+            {
+                return false;
+            }
+            *input = c;
+            return true;
+    }
+
+    do
+    {
+        switch (*c)
+        {
+            case '\0':
+                return false;
+            case '"':
+                for (c++; *c != '"'; c++)
+                {
+                    if (*c == '\\') c++;
+                    if (!*c) return false;
+                }
+                break;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                depth--;
+                break;
+            default:
+                break;
+        }
+        c++;
+    } while (depth > 0);
+
+    *input = c;
+    return true;
+}
+
+// Validation checks the full grammar without building anything, so it needs
+// neither a mempool nor the parser's buffers. Nesting is tracked one bit per level.
+#define JSON_VALIDATE_DEPTH 1024
+
+// Returns the character after a number's last, or NULL if there is no valid number.
+const char * _match_JsonNumber(const char * c, const char * end)
+{
+    if (c < end && *c == '-') c++;
+    if (c == end || *c < '0' || *c > '9')
+    {
+        return NULL;
+    }
+
+    // No leading zeros.
+    if (*(c++) != '0')
+    {
+        while (c < end && *c >= '0' && *c <= '9') c++;
+    }
+    return _match_JsonFraction(c, end);
+}
+
+// The optional fraction and exponent after a number's integer digits.
+const char * _match_JsonFraction(const char * c, const char * end)
+{
+    if (c < end && *c == '.')
+    {
+        c++;
+        if (c == end || *c < '0' || *c > '9') return NULL;
+        while (c < end && *c >= '0' && *c <= '9') c++;
+    }
+
+    if (c < end && (*c == 'e' || *c == 'E'))
+    {
+        c++;
+        if (c < end && (*c == '+' || *c == '-')) c++;
+        if (c == end || *c < '0' || *c > '9') return NULL;
+        while (c < end && *c >= '0' && *c <= '9') c++;
+    }
+
+    return c;
+}
+
+// Returns the character after the closing quote, given the one after the opening quote.
+const char * _match_JsonString(const char * c, const char * end)
+{
+    while (true)
+    {
+        // Most of a string needs no closer look, so skip it eight bytes at a time.
+        while (end - c >= 8)
+        {
+            u_int64_t chunk;
+            memcpy(&chunk, c, sizeof(chunk));
+            if (!SWAR_IS_PLAIN(chunk))
+            {
+                break;
+            }
+            c += 8;
+        }
+
+        if (c == end || (unsigned char) *c < 0x20)
+        {
+            return NULL;
+        }
+
+        if ((unsigned char) *c >= 0x80)
+        {
+            int length = _match_Utf8((const unsigned char *) c, (const unsigned char *) end);
+            if (!length) return NULL;
+            c += length;
+            continue;
+        }
+
+        switch (*(c++))
+        {
+            case '"':
+                return c;
+            case '\\':
+                if (c == end) return NULL;
+                switch (*(c++))
+                {
+                    case '"': case '\\': case '/': case 'b':
+                    case 'f': case 'n': case 'r': case 't':
+                        break;
+                    case 'u':
+                    {
+                        u_int32_t code, low;
+                        if (end - c < 4 || !_scan_hex4(c, &code) || (code >= 0xDC00 && code <= 0xDFFF)) return NULL;
+                        c += 4;
+                        // A high surrogate must be followed by an escaped low surrogate.
+                        if (code >= 0xD800 && code <= 0xDBFF)
+                        {
+                            if (end - c < 6 || c[0] != '\\' || c[1] != 'u' || !_scan_hex4(c + 2, &low) ||
+                                low < 0xDC00 || low > 0xDFFF) return NULL;
+                            c += 6;
+                        }
+                        break;
+                    }
+                    default:
+                        return NULL;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+const char * _match_JsonWhitespace(const char * c, const char * end)
+{
+    while (c < end && (*c == ' ' || *c == '\n' || *c == '\r' || *c == '\t')) c++;
+    return c;
+}
+
+enum _ValidateState
+{
+    Validate_Value,
+    Validate_Key,
+    Validate_AfterValue,
+};
+
+bool validate_Json(char * input, size_t length)
+{
+    const char * c = input;
+    const char * end = input + length;
+    u_int64_t arrays[JSON_VALIDATE_DEPTH / 64];   // Bit set when the level is an array
+    int depth = 0;
+
+    // Like parse_JsonObject, only objects are accepted at the top level.
+    c = _match_JsonWhitespace(c, end);
+    if (c == end || *c != '{')
+    {
+        return false;
+    }
+
+    enum _ValidateState state = Validate_Value;
+    while (true)
+    {
+        c = _match_JsonWhitespace(c, end);
+        if (c == end)
+        {
+            return state == Validate_AfterValue && depth == 0;
+        }
+
+        switch (state)
+        {
+            case Validate_Value:
+                switch (*c)
+                {
+                    case '{':
+                    case '[':
+                    {
+                        if (depth == JSON_VALIDATE_DEPTH)
+                        {
+                            return false;
+                        }
+
+                        u_int64_t bit = 1ULL << (depth % 64);
+                        bool isArray = *(c++) == '[';
+                        arrays[depth / 64] = isArray ? arrays[depth / 64] | bit : arrays[depth / 64] & ~bit;
+                        depth++;
+
+                        c = _match_JsonWhitespace(c, end);
+                        if (c < end && *c == (isArray ? ']' : '}'))
+                        {
+                            c++;
+                            depth--;
+                            state = Validate_AfterValue;
+                        }
+                        else
+                        {
+                            state = isArray ? Validate_Value : Validate_Key;
+                        }
+                        break;
+                    }
+                    case '"':
+                        c = _match_JsonString(c + 1, end);
+                        state = Validate_AfterValue;
+                        break;
+                    case 't':
+                        c = end - c >= 4 && memcmp(c, "true", 4) == 0 ? c + 4 : NULL;
+                        state = Validate_AfterValue;
+                        break;
+                    case 'f':
+                        c = end - c >= 5 && memcmp(c, "false", 5) == 0 ? c + 5 : NULL;
+                        state = Validate_AfterValue;
+                        break;
+                    case 'n':
+                        c = end - c >= 4 && memcmp(c, "null", 4) == 0 ? c + 4 : NULL;
+                        state = Validate_AfterValue;
+                        break;
+                    default:
+                        c = _match_JsonNumber(c, end);
+                        state = Validate_AfterValue;
+                        break;
+                }
+                break;
+            case Validate_Key:
+                if (*c != '"' || !(c = _match_JsonString(c + 1, end)))
+                {
+                    return false;
+                }
+                c = _match_JsonWhitespace(c, end);
+                if (c == end || *(c++) != ':')
+                {
+                    return false;
+                }
+                state = Validate_Value;
+                break;
+            case Validate_AfterValue:
+            {
+                if (depth == 0)
+                {
+                    // Only whitespace may follow the top level object.
+                    return false;
+                }
+
+                bool isArray = arrays[(depth - 1) / 64] & (1ULL << ((depth - 1) % 64));
+                if (*c == ',')
+                {
+                    c++;
+                    state = isArray ? Validate_Value : Validate_Key;
+                }
+                else if (*c == (isArray ? ']' : '}'))
+                {
+                    c++;
+                    depth--;
+                }
+                else
+                {
+                    return false;
+                }
+                break;
+            }
+        }
+
+        if (!c)
+        {
+            return false;
+        }
+    }
+}
+
+#define JSON_ARRAY_BUFFER_LENGTH 1024
+
+typedef struct _Parser
+{
+    char* input;
+    char* scanEnd;              // The input before this has no terminator in it
+    char* buffer;
+    char* bufferEnd;
+    JsonValue* arrayBuffer;
+    JsonValue* arrayBufferEnd;
+    JsonParseErrorCode error;
+    int failedState;
+
+    // Projection. Each object level has a mask of the paths that match it so
+    // far, indexed like jsonObjectStack.
+    char ** paths;
+    u_int64_t rootMask;
+    u_int64_t pendingMask;
+    u_int64_t pathMasks[JSON_STACK_LENGTH];
+
+    // How many values each shaped object being parsed has, indexed like jsonObjectStack.
+    u_int16_t shapeFilled[JSON_STACK_LENGTH];
+
+    // When set, values are handed to the handler instead of being stored.
+    JsonHandler * handler;
+    _Stack jsonParseStack;
+    _Stack jsonObjectStack;
+    _Stack jsonBufferStack;
+    _Stack jsonDeserializeStack;
+} _Parser;
+
+enum JsonParseTypes
+{
+    Parse_JsonObjectStart,
+    Parse_JsonMembers,
+    Parse_JsonElements,
+    Parse_JsonValue,
+    Parse_Colon,
+    Parse_JsonValueSeparator,
+    Parse_JsonElementSeparator,
+    Parse_JsonString,
+    Parse_JsonNumber,
+};
+
+// Create the jump table for the parser
+bool parse_JsonObjectStart(_Parser *);
+bool parse_JsonMembers(_Parser *);
+bool parse_JsonElements(_Parser *);
+bool parse_JsonValue(_Parser *);
+bool parse_Colon(_Parser *);
+bool parse_JsonValueSeparator(_Parser *);
+bool parse_JsonElementSeparator(_Parser *);
+bool parse_JsonString(_Parser *);
+bool parse_JsonNumber(_Parser *);
+bool (*_parser_jump_table[9])(_Parser*) =
+{
+    &parse_JsonObjectStart,
+    &parse_JsonMembers,
+    &parse_JsonElements,
+    &parse_JsonValue,
+    &parse_Colon,
+    &parse_JsonValueSeparator,
+    &parse_JsonElementSeparator,
+    &parse_JsonString,
+    &parse_JsonNumber,
+};
+
+enum JsonDeserializeTypes
+{
+    Deserialize_JsonObject,
+    Deserialize_JsonArray,
+};
+
+// Records why parsing failed, for errors that are not just an unexpected token.
+bool _parse_fail(_Parser * parser, JsonParseErrorCode code)
+{
+    parser->error = code;
+    return false;
+}
+
+// Closing brackets end members and elements, which a trailing comma would leave
+// one short of. Checked at the bracket rather than at every comma, by looking back
+// past whitespace, which always stops at the comma or the opening bracket.
+bool _follows_comma(_Parser * parser)
+{
+    char * c = parser->input;
+    while (c[-1] == ' ' || c[-1] == '\t' || c[-1] == '\n' || c[-1] == '\r')
+    {
+        c--;
+    }
+    return c[-1] == ',';
+}
+
+void next_token(_Parser* p)
+{
+    #ifdef DEBUG_JSON
+    printf("Current token: '%c'\n", *p->input);
+    #endif
+    p->input++;
+}
+
+void skip_whitespace(_Parser* parser)
+{
+    #ifdef JSON_PROFILE
+    char * start = parser->input;
+    skip_JsonWhitespace(&parser->input);
+    json_profile.whitespace_bytes += parser->input - start;
+    #else
+    skip_JsonWhitespace(&parser->input);
+    #endif
+}
+
+// Set in a path mask once a path has matched completely, so that everything
+// below is kept.
+#define JSON_PATH_WHOLE (1ULL << 63)
+
+// Matches key against segment `index` of a JSON pointer. Returns what follows
+// the segment, or NULL if it does not match.
+char * _match_pointer_segment(char * path, int index, char * key)
+{
+    for (; index > 0; index--)
+    {
+        path = strchr(path + 1, '/');
+        if (!path)
+        {
+            return NULL;
+        }
+    }
+
+    for (path++; *path && *path != '/'; path++, key++)
+    {
+        char c = *path;
+        if (c == '~')
+        {
+            if (path[1] != '0' && path[1] != '1')
+            {
+                return NULL;
+            }
+            c = *(++path) == '1' ? '/' : '~';
+        }
+        if (*key != c)
+        {
+            return NULL;
+        }
+    }
+    return *key ? NULL : path;
+}
+
+// Works out which paths still match below key, in the object at depth.
+u_int64_t _project_key(_Parser * parser, u_int64_t mask, int depth, char * key)
+{
+    u_int64_t next = 0;
+    for (int i = 0; mask; i++, mask >>= 1)
+    {
+        if (mask & 1)
+        {
+            char * rest = _match_pointer_segment(parser->paths[i], depth, key);
+            if (rest && !*rest)
+            {
+                return JSON_PATH_WHOLE;
+            }
+            if (rest)
+            {
+                next |= 1ULL << i;
+            }
+        }
+    }
+    return next;
+}
+
+// Reports a finished scalar to the handler. Objects and arrays are reported as
+// they start and end instead.
+bool _emit_value(_Parser * parser, JsonValue * value)
+{
+    JsonHandler * h = parser->handler;
+    bool keepGoing = true;
+    switch (value->type)
+    {
+        case JSON_STRING:
+        {
+            // The string is dropped from the buffer as soon as it has been handed out.
+            char * str = pop_ptr(&parser->jsonBufferStack);
+            if (h->on_string) keepGoing = h->on_string(h->context, str, parser->buffer - 1 - str);
+            parser->buffer = str;
+            break;
+        }
+        case JSON_INT:
+            if (h->on_integer) keepGoing = h->on_integer(h->context, value->data.i);
+            else if (h->on_number) keepGoing = h->on_number(h->context, value->data.i);
+            break;
+        case JSON_DOUBLE:
+            if (h->on_number) keepGoing = h->on_number(h->context, value->data.d);
+            break;
+        case JSON_BOOL:
+            if (h->on_bool) keepGoing = h->on_bool(h->context, value->data.b);
+            break;
+        case JSON_NULL:
+            if (h->on_null) keepGoing = h->on_null(h->context);
+            break;
+        default:
+            break;
+    }
+    return keepGoing || _parse_fail(parser, JSON_PARSE_STOPPED);
+}
+
+bool _emit_event(_Parser * parser, bool (*callback)(void *))
+{
+    return !callback || callback(parser->handler->context) || _parse_fail(parser, JSON_PARSE_STOPPED);
+}
+
+// Hands a parsed value to whatever holds it: the object being parsed, under the
+// key on the buffer stack, or the array being parsed. A string value is still
+// on top of the buffer stack.
+bool _store_value(_Parser * parser, JsonValue value)
+{
+    if (parser->handler)
+    {
+        return _emit_value(parser, &value);
+    }
+
+    if (peek_int(&parser->jsonDeserializeStack) == Deserialize_JsonArray)
+    {
+        // With arrays, strings are kept in the buffer until the array is built.
+        *(parser->arrayBuffer++) = value;
+        return true;
+    }
+
+    void * data = &(value.data);
+    switch (value.type)
+    {
+        case JSON_STRING:
+            data = pop_ptr(&parser->jsonBufferStack);
+            break;
+        case JSON_OBJECT:
+            data = value.data.o;
+            break;
+        case JSON_ARRAY:
+            data = value.data.a;
+            break;
+        default:
+            break;
+    }
+
+    JsonObject * o = peek_ptr(&parser->jsonObjectStack);
+    parser->buffer = pop_ptr(&parser->jsonBufferStack);
+    if (_is_shaped(o))
+    {
+        // Values go straight into the vector while keys come in the shape's order.
+        u_int16_t * filled = &(parser->shapeFilled[parser->jsonObjectStack.stacktop]);
+        JsonSlot * slot = _shape_slot(o, parser->buffer, *filled);
+        if (slot)
+        {
+            (*filled)++;
+            return _set_slot(slot, data, value.type) || _parse_fail(parser, JSON_PARSE_OUT_OF_MEMORY);
+        }
+        if (!_unshape_JsonObject(o, *filled))
+        {
+            return _parse_fail(parser, JSON_PARSE_OUT_OF_MEMORY);
+        }
+    }
+
+    if (!_set_value(o, parser->buffer, data, value.type))
+    {
+        return _parse_fail(parser, JSON_PARSE_OUT_OF_MEMORY);
+    }
+    return true;
+}
+
+// Objects in an array start out with the shape of the array's first object, which
+// is made into a shape once a second object follows it. Once an object turns out
+// to have other keys, the objects after it get tries of their own.
+JsonObject * _start_JsonObject(_Parser * parser)
+{
+    if (parser->jsonDeserializeStack.stacktop >= 0 &&
+        peek_int(&parser->jsonDeserializeStack) == Deserialize_JsonArray)
+    {
+        JsonValue * first = peek_ptr(&parser->jsonObjectStack);
+        JsonValue * previous = parser->arrayBuffer - 1;
+        if (previous >= first && previous->type == JSON_OBJECT)
+        {
+            if (previous == first && !_is_shaped(first->data.o))
+            {
+                _shape_JsonObject(first->data.o);
+            }
+            if (_is_shaped(previous->data.o))
+            {
+                parser->shapeFilled[parser->jsonObjectStack.stacktop + 1] = 0;
+                return _create_shaped_JsonObject(previous->data.o->node.child);
+            }
+        }
+    }
+    return create_JsonObject();
+}
+
+// Copies the elements collected in the array buffer into array, from index on.
+bool _fill_JsonArray(_Parser * parser, JsonArray * array, u_int16_t index, JsonValue * firstElement)
+{
+    for (int i = parser->arrayBuffer - firstElement - 1; i >= 0; i--)
+    {
+        JsonValue element = firstElement[i];
+        void * data = &(element.data);
+        switch (element.type)
+        {
+            case JSON_STRING:
+                data = element.data.s;
+                break;
+            case JSON_OBJECT:
+                data = element.data.o;
+                break;
+            case JSON_ARRAY:
+                data = element.data.a;
+                break;
+            default:
+                break;
+        }
+
+        // Compact slots can allocate for any type, since large integers are boxed.
+        if (!_set_element(array, index + i, data, element.type))
+        {
+            return _parse_fail(parser, JSON_PARSE_OUT_OF_MEMORY);
+        }
+        if (element.type == JSON_STRING)
+        {
+            // Strings are stored in the parser's buffer, so they need to popped.
+            parser->buffer = pop_ptr(&parser->jsonBufferStack);
+        }
+    }
+
+    parser->arrayBuffer = firstElement;
+    return true;
+}
+
+// Copies the elements collected in the array buffer into a new array.
+JsonArray * _build_JsonArray(_Parser * parser, JsonValue * firstElement)
+{
+    PROFILE_START(tree_cycles);
+    JsonArray * array = create_JsonArray(parser->arrayBuffer - firstElement);
+    bool built = array ? _fill_JsonArray(parser, array, 0, firstElement) : _parse_fail(parser, JSON_PARSE_OUT_OF_MEMORY);
+    PROFILE_STOP(tree_cycles);
+    return built ? array : NULL;
+}
+
+bool parse_JsonObjectStart(_Parser* parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing object start\n");
+    #endif
+    skip_whitespace(parser);
+    switch (*(parser->input))
+    {
+        case '{':
+        {
+            JsonObject * obj = NULL;
+            if (parser->handler)
+            {
+                if (!_emit_event(parser, parser->handler->on_object_start))
+                {
+                    return false;
+                }
+            }
+            else if (!(obj = _start_JsonObject(parser)))
+            {
+                return _parse_fail(parser, JSON_PARSE_OUT_OF_MEMORY);
+            }
+
+            if (parser->paths && parser->jsonObjectStack.stacktop < JSON_STACK_LENGTH - 1)
+            {
+                // Objects in arrays are kept whole, like the arrays they are in.
+                u_int64_t * mask = &(parser->pathMasks[parser->jsonObjectStack.stacktop + 1]);
+                if (parser->jsonDeserializeStack.stacktop < 0)
+                {
+                    *mask = parser->rootMask;
+                }
+                else
+                {
+                    bool inArray = peek_int(&parser->jsonDeserializeStack) == Deserialize_JsonArray;
+                    *mask = inArray ? JSON_PATH_WHOLE : parser->pendingMask;
+                }
+            }
+            pop_int(&parser->jsonParseStack);
+            push_int(&parser->jsonParseStack, Parse_JsonMembers);
+            push_ptr(&parser->jsonObjectStack, obj);
+            push_int(&parser->jsonDeserializeStack, Deserialize_JsonObject);
+            next_token(parser);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool parse_JsonElements(_Parser* parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing elements\n");
+    #endif
+    skip_whitespace(parser);
+    switch (*(parser->input))
+    {
+        case ']':
+        {
+            if (_follows_comma(parser))
+            {
+                return false;
+            }
+            pop_int(&parser->jsonParseStack);
+            pop_int(&parser->jsonDeserializeStack);
+            JsonValue * firstElement = pop_ptr(&parser->jsonObjectStack);
+            JsonValue value = { .type = JSON_ARRAY };
+            if (parser->handler)
+            {
+                if (!_emit_event(parser, parser->handler->on_array_end))
+                {
+                    return false;
+                }
+            }
+            else if (!(value.data.a = _build_JsonArray(parser, firstElement)))
+            {
+                return false;
+            }
+
+            if (!_store_value(parser, value))
+            {
+                return false;
+            }
+            next_token(parser);
+            return true;
+        }
+        default:
+            if (parser->arrayBuffer >= parser->arrayBufferEnd)
+            {
+                return _parse_fail(parser, JSON_PARSE_LIMIT_EXCEEDED);
+            }
+            push_int(&parser->jsonParseStack, Parse_JsonElementSeparator);
+            push_int(&parser->jsonParseStack, Parse_JsonValue);
+            return true;
+    }
+}
+
+bool parse_JsonMembers(_Parser* parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing members\n");
+    #endif
+    skip_whitespace(parser);
+    switch (*(parser->input))
+    {
+        case '}':
+            if (_follows_comma(parser))
+            {
+                return false;
+            }
+            pop_int(&parser->jsonDeserializeStack);
+            pop_int(&parser->jsonParseStack);
+            if (parser->handler && !_emit_event(parser, parser->handler->on_object_end))
+            {
+                return false;
+            }
+            if (parser->jsonObjectStack.stacktop > 0)
+            {
+                // Shaped objects that are missing keys get a trie of their own.
+                u_int16_t filled = parser->shapeFilled[parser->jsonObjectStack.stacktop];
+                JsonObject* child = pop_ptr(&parser->jsonObjectStack);
+                if (child && _is_shaped(child) && filled < _shape_length(child) && !_unshape_JsonObject(child, filled))
+                {
+                    return _parse_fail(parser, JSON_PARSE_OUT_OF_MEMORY);
+                }
+                if (!_store_value(parser, (JsonValue) { .type = JSON_OBJECT, .data.o = child }))
+                {
+                    return false;
+                }
+            }
+            next_token(parser);
+            return true;
+        case '"':
+            push_int(&parser->jsonParseStack, Parse_JsonValueSeparator);
+            push_int(&parser->jsonParseStack, Parse_JsonValue);
+            push_int(&parser->jsonParseStack, Parse_Colon);
+            push_int(&parser->jsonParseStack, Parse_JsonString);
+            next_token(parser);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Decodes the character following a backslash. *input points at the backslash
+// and is left on the last character of the escape sequence.
+bool _scan_EscapedChar(char ** input, char ** destination)
+{
+    (*input)++;
+    switch (**input)
+    {
+        case '"':
+            *((*destination)++) = '\"';
+            break;
+        case '\\':
+            *((*destination)++) = '\\';
+            break;
+        case '/':
+            *((*destination)++) = '/';
+            break;
+        case 'b':
+            *((*destination)++) = '\b';
+            break;
+        case 'f':
+            *((*destination)++) = '\f';
+            break;
+        case 'n':
+            *((*destination)++) = '\n';
+            break;
+        case 'r':
+            *((*destination)++) = '\r';
+            break;
+        case 't':
+            *((*destination)++) = '\t';
+            break;
+        case 'u':
+        {
+            u_int32_t code, low;
+            // Strings are terminated, so an escaped NUL cannot be represented.
+            if (!_scan_hex4(*input + 1, &code) || !code || (code >= 0xDC00 && code <= 0xDFFF))
+            {
+                return false;
+            }
+            *input += 4;
+
+            // A high surrogate must be followed by an escaped low surrogate.
+            if (code >= 0xD800 && code <= 0xDBFF)
+            {
+                if ((*input)[1] != '\\' || (*input)[2] != 'u' || !_scan_hex4(*input + 3, &low) ||
+                    low < 0xDC00 || low > 0xDFFF)
+                {
+                    return false;
+                }
+                *input += 6;
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }
+            *destination += _encode_Utf8(code, *destination);
+            break;
+        }
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+bool parse_EscapedChar(_Parser * parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing escaped character\n");
+    #endif
+    PROFILE_ADD(escapes, 1);
+    return _scan_EscapedChar(&parser->input, &parser->buffer);
+}
+
+// Input is read eight bytes at a time only where all eight are known to come
+// before the terminator, since reading past it is undefined even when it cannot
+// fault. Terminated input has no length, so it is measured a stretch at a time,
+// as the parser gets there.
+#define JSON_SCAN_AHEAD 1024
+
+// Measures how far the input goes without a terminator, from where the parser is.
+char * _extend_scan(_Parser * parser)
+{
+    parser->scanEnd = parser->input + strnlen(parser->input, JSON_SCAN_AHEAD);
+    return parser->scanEnd;
+}
+
+bool parse_JsonString(_Parser * parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing string\n");
+    #endif
+    PROFILE_START(string_cycles);
+    push_ptr(&parser->jsonBufferStack, parser->buffer);
+    while (*(parser->input))
+    {
+        // Leaves room for the longest escape sequence and the terminator.
+        if (parser->bufferEnd - parser->buffer < 5)
+        {
+            PROFILE_STOP(string_cycles);
+            return _parse_fail(parser, JSON_PARSE_LIMIT_EXCEEDED);
+        }
+
+        // Plain ASCII needs no decoding, so copy it eight bytes at a time.
+        char * scanEnd = parser->scanEnd;
+        if (scanEnd - parser->input < 8)
+        {
+            scanEnd = _extend_scan(parser);
+        }
+        while (parser->bufferEnd - parser->buffer >= 8 + 5 && scanEnd - parser->input >= 8)
+        {
+            u_int64_t chunk;
+            memcpy(&chunk, parser->input, sizeof(chunk));
+            if (!SWAR_IS_PLAIN(chunk))
+            {
+                break;
+            }
+            memcpy(parser->buffer, &chunk, sizeof(chunk));
+            parser->buffer += 8;
+            parser->input += 8;
+        }
+
+        unsigned char c = *(parser->input);
+        if (c >= 0x80)
+        {
+            // Multi-byte characters are validated as they are copied.
+            int length = _match_Utf8((unsigned char *) parser->input, (unsigned char *) parser->input + 4);
+            if (!length)
+            {
+                PROFILE_STOP(string_cycles);
+                return _parse_fail(parser, JSON_PARSE_INVALID_UTF8);
+            }
+            memcpy(parser->buffer, parser->input, length);
+            parser->buffer += length;
+            parser->input += length;
+            continue;
+        }
+        else if (c < 0x20)
+        {
+            // Control characters must be escaped. This also catches the terminator.
+            break;
+        }
+
+        switch (c)
+        {
+            case '"':
+                *(parser->buffer++) = '\0';
+                pop_int(&parser->jsonParseStack);
+                next_token(parser);
+                PROFILE_STOP(string_cycles);
+                return true;
+            case '\\':
+                if (!parse_EscapedChar(parser))
+                {
+                    PROFILE_STOP(string_cycles);
+                    return _parse_fail(parser, JSON_PARSE_INVALID_ESCAPE);
+                }
+                break;
+            default:
+                *(parser->buffer++) = *(parser->input);
+        }
+        next_token(parser);
+    }
+
+    // The input ended, or held a raw control character, before the closing quote.
+    PROFILE_STOP(string_cycles);
+    return false;
+}
+
+bool parse_Colon(_Parser * parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing colon\n");
+    #endif
+    skip_whitespace(parser);
+    switch (*(parser->input))
+    {
+        case ':':
+            pop_int(&parser->jsonParseStack);
+            next_token(parser);
+            if (parser->handler)
+            {
+                // Keys are handed out as soon as they are complete, so the buffer
+                // only ever holds one string.
+                char * key = pop_ptr(&parser->jsonBufferStack);
+                JsonHandler * h = parser->handler;
+                if (h->on_key && !h->on_key(h->context, key, parser->buffer - 1 - key))
+                {
+                    return _parse_fail(parser, JSON_PARSE_STOPPED);
+                }
+                parser->buffer = key;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+bool parse_JsonValue(_Parser * parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing json value\n");
+    #endif
+    skip_whitespace(parser);
+    pop_int(&parser->jsonParseStack);
+
+    // Members that no path wants are skipped before anything is stored.
+    if (parser->paths && peek_int(&parser->jsonDeserializeStack) == Deserialize_JsonObject)
+    {
+        int depth = parser->jsonObjectStack.stacktop;
+        u_int64_t mask = parser->pathMasks[depth];
+        if (!(mask & JSON_PATH_WHOLE))
+        {
+            mask = _project_key(parser, mask, depth, peek_ptr(&parser->jsonBufferStack));
+            if (!mask)
+            {
+                parser->buffer = pop_ptr(&parser->jsonBufferStack);
+                return skip_JsonValue(&parser->input);
+            }
+        }
+        parser->pendingMask = mask;
+    }
+
+    switch (*(parser->input))
+    {
+        case '"':
+            next_token(parser);
+            push_int(&parser->jsonParseStack, Parse_JsonString);
+            if (!parse_JsonString(parser))
+            {
+                return false;
+            }
+            if (!_store_value(parser, (JsonValue) { .type = JSON_STRING, .data.s = peek_ptr(&parser->jsonBufferStack) }))
+            {
+                return false;
+            }
+            break;
+        case 'n':
+        {
+            for (unsigned long i = 0; i < sizeof(_JSON_NULL_STR) - 1; i++)
+            {
+                if (*(parser->input) != _JSON_NULL_STR[i]) return false;
+                next_token(parser);
+            }
+            if (!_store_value(parser, (JsonValue) { .type = JSON_NULL, .data.n = NULL }))
+            {
+                return false;
+            }
+            break;
+        }
+        case 't':
+        {
+            for (unsigned long i = 0; i < sizeof(_JSON_TRUE_STR) - 1; i++)
+            {
+                if (*(parser->input) != _JSON_TRUE_STR[i]) return false;
+                next_token(parser);
+            }
+            if (!_store_value(parser, (JsonValue) { .type = JSON_BOOL, .data.b = true }))
+            {
+                return false;
+            }
+            break;
+        }
+        case 'f':
+        {
+            for (unsigned long i = 0; i < sizeof(_JSON_FALSE_STR) - 1; i++)
+            {
+                if (*(parser->input) != _JSON_FALSE_STR[i]) return false;
+                next_token(parser);
+            }
+            if (!_store_value(parser, (JsonValue) { .type = JSON_BOOL, .data.b = false }))
+            {
+                return false;
+            }
+            break;
+        }
+        case '0': case '1': case '2': case '3': case '4': case '5':
+        case '6': case '7': case '8': case '9': case '-':
+            push_int(&parser->jsonParseStack, Parse_JsonNumber);
+            break;
+        case '{':
+            push_int(&parser->jsonParseStack, Parse_JsonObjectStart);
+            break;
+        case '[':
+            if (parser->handler && !_emit_event(parser, parser->handler->on_array_start))
+            {
+                return false;
+            }
+            push_int(&parser->jsonParseStack, Parse_JsonElements);
+            push_int(&parser->jsonDeserializeStack, Deserialize_JsonArray);
+            push_ptr(&parser->jsonObjectStack, parser->arrayBuffer);
+            next_token(parser);
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+bool parse_JsonValueSeparator(_Parser* parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing json value separator\n");
+    #endif
+    skip_whitespace(parser);
+    switch (*(parser->input))
+    {
+        case '}':
+            pop_int(&parser->jsonParseStack);
+            return true;
+        case ',':
+            next_token(parser);
+            pop_int(&parser->jsonParseStack);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool parse_JsonElementSeparator(_Parser* parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing json element separator\n");
+    #endif
+    skip_whitespace(parser);
+    switch (*(parser->input))
+    {
+        case ']':
+            pop_int(&parser->jsonParseStack);
+            return true;
+        case ',':
+            next_token(parser);
+            pop_int(&parser->jsonParseStack);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool parse_JsonNumber(_Parser *parser)
+{
+    #ifdef DEBUG_JSON
+    printf("Parsing json number\n");
+    #endif
+    JsonValue value;
+    PROFILE_START(number_cycles);
+    bool scanned = _scan_JsonNumber_value(&parser->input, &value);
+    PROFILE_STOP(number_cycles);
+    if (!scanned)
+    {
+        return _parse_fail(parser, JSON_PARSE_INVALID_NUMBER);
+    }
+    PROFILE_ADD(numbers, 1);
+
+    if (!_store_value(parser, value))
+    {
+        return false;
+    }
+
+    pop_int(&parser->jsonParseStack);
+    return true;
+}
+
+#ifdef JSON_PROFILE
+const char * _parse_state_names[] =
+{
+    "object_start",
+    "members",
+    "elements",
+    "value",
+    "colon",
+    "value_separator",
+    "element_separator",
+    "string",
+    "number",
+};
+
+void Json_get_profile(JsonProfile * p)
+{
+    *p = json_profile;
+}
+
+void Json_reset_profile()
+{
+    memset(&json_profile, 0, sizeof(JsonProfile));
+}
+
+const char * Json_parse_state_name(int state)
+{
+    return state >= 0 && state < JSON_PARSE_STATES ? _parse_state_names[state] : NULL;
+}
+
+void _profile_stack_peak(_Stack * s, int i)
+{
+    if (s->peak + 1 > json_profile.peak_depth[i])
+    {
+        json_profile.peak_depth[i] = s->peak + 1;
+    }
+}
+#endif
+
+const char * _parse_error_names[] =
+{
+    "No error",
+    "Unexpected token",
+    "Unexpected end of input",
+    "Invalid escape sequence",
+    "Invalid number",
+    "Parser limit exceeded",
+    "Out of memory",
+    "Stopped by handler",
+    "Invalid UTF-8",
+    "Could not read file",
+};
+
+// What each parse state was looking for when it failed.
+const char * _parse_state_expected[] =
+{
+    "'{'",
+    "'\"' or '}'",
+    "a value or ']'",
+    "a value",
+    "':'",
+    "',' or '}'",
+    "',' or ']'",
+    "'\"'",
+    "a number",
+};
+
+void print_JsonParseError(char * input, JsonParseError * error)
+{
+    const int inputLength = 50, maxLeadingChars = 40;
+    char * bad = input + error->offset;
+    char * start = error->offset > (size_t) maxLeadingChars ? bad - maxLeadingChars : input;
+
+    char erroneousInput[inputLength + 1];
+    int i;
+    for (i = 0; i < inputLength && start[i]; i++)
+    {
+        // Keep the arrow lined up with the input.
+        erroneousInput[i] = start[i] == '\n' || start[i] == '\t' || start[i] == '\r' ? ' ' : start[i];
+    }
+    erroneousInput[i] = '\0';
+
+    printf(
+        CONSOLE_RED "%s at line %d, column %d (position %zu), expected %s\n" CONSOLE_RESET,
+        _parse_error_names[error->code],
+        error->line,
+        error->column,
+        error->offset,
+        error->expected);
+    printf(CONSOLE_RED "%s\n" CONSOLE_RESET, erroneousInput);
+    printf(CONSOLE_RED "%*s^\n" CONSOLE_RESET, (int)(bad - start), "");
+}
+
+void _init_parser(_Parser * parser, char * input, char * stringBuffer, JsonValue * arrayBuffer)
+{
+    parser->input = input;
+    parser->scanEnd = input;
+    parser->buffer = stringBuffer;
+    parser->bufferEnd = stringBuffer + JSON_STRING_BUFFER_LENGTH;
+    parser->arrayBuffer = arrayBuffer;
+    parser->arrayBufferEnd = arrayBuffer + JSON_ARRAY_BUFFER_LENGTH;
+    parser->error = JSON_PARSE_OK;
+    parser->failedState = Parse_JsonObjectStart;
+    parser->paths = NULL;
+    parser->handler = NULL;
+    parser->jsonParseStack.stacktop = -1;
+    parser->jsonObjectStack.stacktop = -1;
+    parser->jsonBufferStack.stacktop = -1;
+    parser->jsonDeserializeStack.stacktop = -1;
+    parser->jsonParseStack.overflowed = false;
+    parser->jsonObjectStack.overflowed = false;
+    parser->jsonBufferStack.overflowed = false;
+    parser->jsonDeserializeStack.overflowed = false;
+    #ifdef JSON_PROFILE
+    parser->jsonParseStack.peak = -1;
+    parser->jsonObjectStack.peak = -1;
+    parser->jsonBufferStack.peak = -1;
+    parser->jsonDeserializeStack.peak = -1;
+    json_profile.parses++;
+    #endif
+}
+
+// Dispatches parse states until the parse stack is empty.
+bool _run_parser(_Parser * parser)
+{
+    while (parser->jsonParseStack.stacktop >= 0)
+    {
+        int state = peek_int(&parser->jsonParseStack);
+        PROFILE_ADD(dispatches[state], 1);
+        bool success = _parser_jump_table[state](parser);
+
+        // A push that did not fit means the input is nested too deeply.
+        if (parser->jsonParseStack.overflowed || parser->jsonObjectStack.overflowed ||
+            parser->jsonBufferStack.overflowed || parser->jsonDeserializeStack.overflowed)
+        {
+            success = _parse_fail(parser, JSON_PARSE_LIMIT_EXCEEDED);
+        }
+
+        if (!success)
+        {
+            parser->failedState = state;
+            if (parser->error == JSON_PARSE_OK)
+            {
+                parser->error = *(parser->input) ? JSON_PARSE_UNEXPECTED_TOKEN : JSON_PARSE_UNEXPECTED_END;
+            }
+            return false;
+        }
+    }
+
+    #ifdef JSON_PROFILE
+    _profile_stack_peak(&parser->jsonParseStack, 0);
+    _profile_stack_peak(&parser->jsonObjectStack, 1);
+    _profile_stack_peak(&parser->jsonBufferStack, 2);
+    _profile_stack_peak(&parser->jsonDeserializeStack, 3);
+    #endif
+
+    return true;
+}
+
+// Fills in where and why parsing failed. Lines and columns are only counted here,
+// so that rejecting input costs no more than scanning it.
+void _set_parse_error(_Parser * parser, char * input, JsonParseError * error)
+{
+    error->code = parser->error;
+    error->offset = parser->input - input;
+    error->expected = _parse_state_expected[parser->failedState];
+    error->line = 1;
+    error->column = 1;
+    for (char * c = input; c < parser->input; c++)
+    {
+        if (*c == '\n')
+        {
+            error->line++;
+            error->column = 1;
+        }
+        else
+        {
+            error->column++;
+        }
+    }
+}
+
+bool _parse_JsonObject(
+    char* input, char * end, JsonObject** parsed, JsonParseError * error, char ** paths, int nPaths, JsonHandler * handler);
+
+bool parse_JsonObject(char* input, JsonObject** parsed)
+{
+    return _parse_JsonObject(input, NULL, parsed, NULL, NULL, 0, NULL);
+}
+
+bool parse_JsonObject_with_error(char* input, JsonObject** parsed, JsonParseError * error)
+{
+    return _parse_JsonObject(input, NULL, parsed, error, NULL, 0, NULL);
+}
+
+// Checks that path is a JSON pointer: empty, or segments that each start with a
+// '/', in which every '~' is followed by a '0' or a '1'.
+bool _is_JsonPointer(char * path)
+{
+    if (*path && *path != '/')
+    {
+        return false;
+    }
+
+    for (; *path; path++)
+    {
+        if (*path == '~' && path[1] != '0' && path[1] != '1')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_JsonObject_projected(char* input, char ** paths, int nPaths, JsonObject** parsed)
+{
+    *parsed = NULL;
+    if (nPaths < 0 || nPaths > JSON_PROJECTION_PATHS)
+    {
+        return false;
+    }
+    for (int i = 0; i < nPaths; i++)
+    {
+        if (!_is_JsonPointer(paths[i]))
+        {
+            return false;
+        }
+    }
+    // No paths still means projecting, onto nothing.
+    static char * noPaths[1];
+    return _parse_JsonObject(input, NULL, parsed, NULL, paths ? paths : noPaths, nPaths, NULL);
+}
+
+bool parse_JsonEvents(char* input, JsonHandler * handler, JsonParseError * error)
+{
+    JsonObject * parsed;
+    return _parse_JsonObject(input, NULL, &parsed, error, NULL, 0, handler);
+}
+
+// The file is mapped over a larger anonymous mapping, so at least one zeroed byte
+// follows it, even when its size is a multiple of the page size. That byte ends
+// the input like a terminator would, and a NUL inside the file is caught by
+// checking that parsing ended at the end of the file.
+bool parse_JsonFile(const char * path, JsonObject ** parsed, JsonParseError * error)
+{
+    *parsed = NULL;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        if (fd >= 0) close(fd);
+        if (error) *error = (JsonParseError){ .code = JSON_PARSE_IO_ERROR, .line = 1, .column = 1, .expected = "a file" };
+        return false;
+    }
+
+    size_t length = st.st_size;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t mapped = (length / page + 1) * page;
+    char * input = mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (input != MAP_FAILED && length > 0 &&
+        mmap(input, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(input, mapped);
+        input = MAP_FAILED;
+    }
+    close(fd);
+    if (input == MAP_FAILED)
+    {
+        if (error) *error = (JsonParseError){ .code = JSON_PARSE_IO_ERROR, .line = 1, .column = 1, .expected = "a file" };
+        return false;
+    }
+
+    madvise(input, length, MADV_SEQUENTIAL);
+    bool success = _parse_JsonObject(input, input + length, parsed, error, NULL, 0, NULL);
+    munmap(input, mapped);
+    return success;
+}
+
+// Input ends at its terminator, or at end when that is not NULL.
+bool _parse_JsonObject(
+    char* input, char * end, JsonObject** parsed, JsonParseError * error, char ** paths, int nPaths, JsonHandler * handler)
+{
+    *parsed = NULL;
+    char stringBuffer[JSON_STRING_BUFFER_LENGTH];
+    JsonValue arrayBuffer[JSON_ARRAY_BUFFER_LENGTH];
+    _Parser parser;
+    _init_parser(&parser, input, stringBuffer, arrayBuffer);
+    parser.handler = handler;
+    if (end)
+    {
+        parser.scanEnd = end;
+    }
+    if (paths)
+    {
+        // The empty path is the whole document.
+        parser.paths = paths;
+        parser.rootMask = 0;
+        for (int i = 0; i < nPaths; i++)
+        {
+            parser.rootMask |= paths[i][0] ? 1ULL << i : JSON_PATH_WHOLE;
+        }
+    }
+
+    // Skip leading whitespace
+    skip_whitespace(&parser);
+
+    // Expect to start parsing an object, followed by nothing but whitespace.
+    u_int8_t * top = buffer->top;
+    push_int(&parser.jsonParseStack, Parse_JsonObjectStart);
+    bool success = _run_parser(&parser);
+    size_t consumed = parser.input - input;
+    if (success)
+    {
+        skip_whitespace(&parser);
+        if (*(parser.input) || (end && parser.input != end))
+        {
+            parser.error = JSON_PARSE_UNEXPECTED_TOKEN;
+            success = false;
+        }
+    }
+
+    if (!success)
+    {
+        // Scanners stop at the first NUL, so running out of input before end means
+        // the input holds one, which is a character that cannot appear there.
+        char * nul;
+        if (end && parser.error == JSON_PARSE_UNEXPECTED_END && (nul = memchr(input, '\0', end - input)))
+        {
+            parser.error = JSON_PARSE_UNEXPECTED_TOKEN;
+            parser.input = nul;
+        }
+        if (error)
+        {
+            _set_parse_error(&parser, input, error);
+            if (parser.jsonParseStack.stacktop < 0)
+            {
+                error->expected = "end of input";
+            }
+        }
+        return false;
+    }
+
+    if (error)
+    {
+        error->code = JSON_PARSE_OK;
+    }
+
+    if (handler)
+    {
+        return true;
+    }
+
+    *parsed = pop_ptr(&parser.jsonObjectStack);
+    buffer->stats.last_parse_input = consumed;
+    buffer->stats.last_parse_used = buffer->top - top;
+
+    #ifdef DEBUG_JSON
+    printf("%d\n", parser.jsonParseStack.stacktop);
+    printf("%d\n", parser.jsonObjectStack.stacktop);
+    printf("%d\n", parser.jsonBufferStack.stacktop);
+    printf("%d\n", parser.jsonDeserializeStack.stacktop);
+    printf("%li\n", parser.buffer - stringBuffer);
+    printf("%li\n", parser.arrayBuffer - arrayBuffer);
+    #endif
+
+    return true;
+}
+
+// Parses a single value of any type. The value is parsed as the member "" of a
+// throwaway object, the same way any other member would be.
+bool _parse_JsonValue_text(char ** input, JsonValue * value)
+{
+    char stringBuffer[JSON_STRING_BUFFER_LENGTH];
+    JsonValue arrayBuffer[JSON_ARRAY_BUFFER_LENGTH];
+    _Parser parser;
+    _init_parser(&parser, *input, stringBuffer, arrayBuffer);
+
+    JsonObject * holder = create_JsonObject();
+    if (!holder)
+    {
+        return false;
+    }
+
+    stringBuffer[0] = '\0';
+    parser.buffer = stringBuffer + 1;
+    push_ptr(&parser.jsonObjectStack, holder);
+    push_int(&parser.jsonDeserializeStack, Deserialize_JsonObject);
+    push_ptr(&parser.jsonBufferStack, stringBuffer);
+    push_int(&parser.jsonParseStack, Parse_JsonValue);
+    if (!_run_parser(&parser))
+    {
+        return false;
+    }
+
+    *input = parser.input;
+    *value = get_value(holder, "");
+    return value->type != JSON_ERROR;
+}
+
+// Structural hashing and equality
+JsonSlot * _chain_value(u_int16_t offset, u_int8_t * base)
+{
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            return (JsonSlot *)(base + node->data);
+        }
+        offset = node->sibling;
+    }
+    return NULL;
+}
+
+JsonNode * _chain_find(u_int16_t offset, unsigned char letter)
+{
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        if (node->letter == letter)
+        {
+            return node;
+        }
+        offset = node->sibling;
+    }
+    return NULL;
+}
+
+bool _chain_continues(u_int16_t offset)
+{
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        if (node->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            return true;
+        }
+        offset = node->sibling;
+    }
+    return false;
+}
+
+bool _equal_JsonValue(JsonValue * a, JsonValue * b)
+{
+    if (a == b)
+    {
+        return true;
+    }
+
+    // Numbers are compared by value, whichever types hold them. An integer only
+    // equals a double that is integral and in range, compared as integers, since
+    // integers past 2^53 round when converted to doubles.
+    if (_is_number(a->type) && _is_number(b->type))
+    {
+        if (a->type == JSON_INT || b->type == JSON_INT)
+        {
+            int64_t x, y;
+            return get_int(*a, &x) && get_int(*b, &y) && x == y;
+        }
+        double x, y;
+        return get_double(*a, &x) && get_double(*b, &y) && x == y;
+    }
+    if (a->type != b->type)
+    {
+        return false;
+    }
+
+    switch (a->type)
+    {
+        case JSON_NULL:
+            return true;
+        case JSON_BOOL:
+            return a->data.b == b->data.b;
+        case JSON_STRING:
+            return strcmp(get_string(a), get_string(b)) == 0;
+        case JSON_ARRAY:
+        {
+            if (a->data.a == b->data.a)
+            {
+                return true;
+            }
+            if (a->data.a->length != b->data.a->length)
+            {
+                return false;
+            }
+            JsonSlot * ea = (JsonSlot *)(buffer->start + a->data.a->elements);
+            JsonSlot * eb = (JsonSlot *)(buffer->start + b->data.a->elements);
+            for (int i = 0; i < a->data.a->length; i++)
+            {
+                JsonValue x = _slot_get(&ea[i]);
+                JsonValue y = _slot_get(&eb[i]);
+                if (!_equal_JsonValue(&x, &y)) return false;
+            }
+            return true;
+        }
+        case JSON_OBJECT:
+            return json_equal(a->data.o, b->data.o);
+        default:
+            return false;
+    }
+}
+
+// Compares two chains of sibling nodes under the same key prefix. Nodes are
+// matched by letter, since insertion order decides the order of a chain. Nodes
+// without any value below them, as left behind by remove_value, are ignored.
+// Shaped objects share chains, so chains are only the same if their values are.
+bool _equal_JsonNode(u_int16_t a, u_int8_t * baseA, u_int16_t b, u_int8_t * baseB)
+{
+    if (a == b && baseA == baseB)
+    {
+        return true;
+    }
+
+    JsonSlot * sa = _chain_value(a, baseA);
+    JsonSlot * sb = _chain_value(b, baseB);
+    if (!sa != !sb)
+    {
+        return false;
+    }
+    if (sa)
+    {
+        JsonValue va = _slot_get(sa);
+        JsonValue vb = _slot_get(sb);
+        if (!_equal_JsonValue(&va, &vb))
+        {
+            return false;
+        }
+    }
+
+    for (u_int16_t offset = a; offset != DEFAULT_OBJECT_ADDRESS; )
+    {
+        JsonNode * x = (JsonNode *)(buffer->start + offset);
+        JsonNode * y = _chain_find(b, x->letter);
+        if (!_equal_JsonNode(x->child, baseA, y ? y->child : DEFAULT_OBJECT_ADDRESS, baseB))
+        {
+            return false;
+        }
+        offset = x->sibling;
+    }
+
+    for (u_int16_t offset = b; offset != DEFAULT_OBJECT_ADDRESS; )
+    {
+        JsonNode * y = (JsonNode *)(buffer->start + offset);
+        if (!_chain_find(a, y->letter) && !_equal_JsonNode(DEFAULT_OBJECT_ADDRESS, baseA, y->child, baseB))
+        {
+            return false;
+        }
+        offset = y->sibling;
+    }
+
+    return true;
+}
+
+bool json_equal(JsonObject * a, JsonObject * b)
+{
+    u_int8_t * baseA, * baseB;
+    u_int16_t trieA = _key_trie(a, &baseA);
+    u_int16_t trieB = _key_trie(b, &baseB);
+    return _equal_JsonNode(trieA, baseA, trieB, baseB);
+}
+
+// splitmix64's finalizer, so that sums of hashes stay well distributed.
+u_int64_t _hash_mix(u_int64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+// FNV-1a
+u_int64_t _hash_bytes(u_int64_t h, const void * data, size_t length)
+{
+    const unsigned char * c = data;
+    for (size_t i = 0; i < length; i++)
+    {
+        h = (h ^ c[i]) * 0x100000001B3ULL;
+    }
+    return h;
+}
+
+u_int64_t _hash_JsonObject(JsonObject * obj, u_int64_t prefix, u_int64_t seed);
+
+u_int64_t _hash_JsonValue(JsonValue * value, u_int64_t seed)
+{
+    // Equal numbers of different types have to hash the same, so all are hashed as doubles.
+    u_int64_t h = _hash_mix(seed + (_is_number(value->type) ? JSON_DOUBLE : value->type));
+    switch (value->type)
+    {
+        case JSON_BOOL:
+            return _hash_mix(h + value->data.b);
+        case JSON_FLOAT:
+        case JSON_INT:
+        case JSON_DOUBLE:
+        {
+            // -0 and 0 are equal, so they have to hash the same.
+            double d;
+            get_double(*value, &d);
+            d = d == 0 ? 0 : d;
+            return _hash_mix(_hash_bytes(h, &d, sizeof(d)));
+        }
+        case JSON_STRING:
+        {
+            char * str = get_string(value);
+            return _hash_mix(_hash_bytes(h, str, strlen(str)));
+        }
+        case JSON_ARRAY:
+        {
+            JsonSlot * elements = (JsonSlot *)(buffer->start + value->data.a->elements);
+            for (int i = 0; i < value->data.a->length; i++)
+            {
+                JsonValue element = _slot_get(&elements[i]);
+                h = _hash_mix(h ^ _hash_JsonValue(&element, seed));
+            }
+            return h;
+        }
+        case JSON_OBJECT:
+            return _hash_mix(h ^ _hash_JsonObject(value->data.o, seed, seed));
+        default:
+            return h;
+    }
+}
+
+// Members are hashed from their key and value, then summed, so the order keys
+// were inserted in does not matter. prefix is the hash of the key so far.
+u_int64_t _hash_JsonNode(u_int16_t offset, u_int8_t * base, u_int64_t prefix, u_int64_t seed)
+{
+    u_int64_t sum = 0;
+    while (offset != DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = (JsonNode *)(buffer->start + offset);
+        if (node->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            JsonValue value = _slot_get((JsonSlot *)(base + node->data));
+            sum += _hash_mix(prefix ^ _hash_JsonValue(&value, seed));
+        }
+        if (node->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            sum += _hash_JsonNode(node->child, base, _hash_bytes(prefix, &(node->letter), 1), seed);
+        }
+        offset = node->sibling;
+    }
+    return sum;
+}
+
+u_int64_t _hash_JsonObject(JsonObject * obj, u_int64_t prefix, u_int64_t seed)
+{
+    u_int8_t * base;
+    u_int16_t trie = _key_trie(obj, &base);
+    return _hash_JsonNode(trie, base, prefix, seed);
+}
+
+u_int64_t json_hash(JsonObject * obj, u_int64_t seed)
+{
+    return _hash_mix(_hash_JsonObject(obj, seed ^ 0xCBF29CE484222325ULL, seed));
+}
+
+// JSON Patch (RFC 6902)
+#define JSON_PATH_LENGTH 1024
+
+typedef struct _Differ
+{
+    _Dumper dumper;
+    char key_buffer[JSON_KEY_LENGTH];
+    char path[JSON_PATH_LENGTH];            // Unescaped path segments, back to back
+    int segments[JSON_STACK_LENGTH + 1];    // Where each segment starts in path
+    int nSegments;
+    bool first;
+    bool failed;                            // A key was too long to write its path
+} _Differ;
+
+void _write_path_segment(_Differ * d, char * segment, int length)
+{
+    char ** destination = &(d->dumper.destination);
+    *((*destination)++) = '/';
+    for (int i = 0; i < length; i++)
+    {
+        switch (segment[i])
+        {
+            case '~':
+                *((*destination)++) = '~';
+                *((*destination)++) = '0';
+                break;
+            case '/':
+                *((*destination)++) = '~';
+                *((*destination)++) = '1';
+                break;
+            default:
+                *destination += _dump_EscapedChar(segment[i], *destination);
+                break;
+        }
+    }
+}
+
+// Writes an operation on the path so far, followed by the first keyLength
+// characters of the current key. A negative keyLength leaves the key out.
+void _write_patch_op(_Differ * d, char * op, int keyLength, JsonValue * value)
+{
+    if (!d->first)
+    {
+        *(d->dumper.destination++) = ',';
+    }
+    d->first = false;
+
+    d->dumper.destination += sprintf(d->dumper.destination, "{\"op\":\"%s\",\"path\":\"", op);
+    for (int i = 0; i < d->nSegments; i++)
+    {
+        _write_path_segment(d, d->path + d->segments[i], d->segments[i + 1] - d->segments[i]);
+    }
+    if (keyLength >= 0)
+    {
+        _write_path_segment(d, d->path + d->segments[d->nSegments], keyLength);
+    }
+    *(d->dumper.destination++) = '"';
+
+    if (value)
+    {
+        d->dumper.destination += sprintf(d->dumper.destination, ",\"value\":");
+        if (value->type == JSON_OBJECT)
+        {
+            _dump_JsonObject(value->data.o, &(d->dumper));
+        }
+        else
+        {
+            _dump_JsonValue(value, &(d->dumper));
+        }
+    }
+    *(d->dumper.destination++) = '}';
+}
+
+// Makes the first keyLength characters of the current key part of the path, as
+// long as there is room left for keys below it.
+bool _push_path_segment(_Differ * d, int keyLength)
+{
+    int end = d->segments[d->nSegments] + keyLength;
+    if (d->nSegments >= JSON_STACK_LENGTH - 1 || end + JSON_KEY_LENGTH > JSON_PATH_LENGTH)
+    {
+        return false;
+    }
+
+    d->nSegments++;
+    d->segments[d->nSegments] = end;
+    return true;
+}
+
+void _diff_JsonObject(_Differ * d, JsonObject * a, JsonObject * b);
+
+void _diff_JsonValue(_Differ * d, int keyLength, JsonValue * a, JsonValue * b)
+{
+    if (a == b)
+    {
+        return;
+    }
+
+    if (_is_number(a->type) && _is_number(b->type))
+    {
+        if (!_equal_JsonValue(a, b)) _write_patch_op(d, "replace", keyLength, b);
+        return;
+    }
+    if (a->type != b->type)
+    {
+        _write_patch_op(d, "replace", keyLength, b);
+        return;
+    }
+
+    switch (a->type)
+    {
+        case JSON_BOOL:
+            if (a->data.b != b->data.b) _write_patch_op(d, "replace", keyLength, b);
+            break;
+        case JSON_STRING:
+            if (strcmp(get_string(a), get_string(b)) != 0)
+            {
+                _write_patch_op(d, "replace", keyLength, b);
+            }
+            break;
+        case JSON_OBJECT:
+            if (a->data.o == b->data.o)
+            {
+                break;
+            }
+            if (!_push_path_segment(d, keyLength))
+            {
+                _write_patch_op(d, "replace", keyLength, b);
+                break;
+            }
+            _diff_JsonObject(d, a->data.o, b->data.o);
+            d->nSegments--;
+            break;
+        case JSON_ARRAY:
+        {
+            if (a->data.a == b->data.a)
+            {
+                break;
+            }
+            if (!_push_path_segment(d, keyLength))
+            {
+                _write_patch_op(d, "replace", keyLength, b);
+                break;
+            }
+
+            // Common elements are compared in place, then the tail is either
+            // appended to, or removed from the back.
+            JsonSlot * ea = (JsonSlot *)(buffer->start + a->data.a->elements);
+            JsonSlot * eb = (JsonSlot *)(buffer->start + b->data.a->elements);
+            int lengthA = a->data.a->length, lengthB = b->data.a->length;
+            char * index = d->path + d->segments[d->nSegments];
+            for (int i = 0; i < lengthA && i < lengthB; i++)
+            {
+                JsonValue x = _slot_get(&ea[i]);
+                JsonValue y = _slot_get(&eb[i]);
+                _diff_JsonValue(d, sprintf(index, "%d", i), &x, &y);
+            }
+            for (int i = lengthA; i < lengthB; i++)
+            {
+                JsonValue y = _slot_get(&eb[i]);
+                _write_patch_op(d, "add", sprintf(index, "%d", i), &y);
+            }
+            for (int i = lengthA - 1; i >= lengthB; i--)
+            {
+                _write_patch_op(d, "remove", sprintf(index, "%d", i), NULL);
+            }
+            d->nSegments--;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Compares two chains of sibling nodes that sit under the same key prefix, so
+// shared prefixes are only walked once. Chains that are the same nodes, such as
+// subtrees shared between both objects, are skipped.
+void _diff_JsonNode(_Differ * d, u_int16_t a, u_int8_t * baseA, u_int16_t b, u_int8_t * baseB, int depth)
+{
+    if (a == b && baseA == baseB)
+    {
+        return;
+    }
+
+    // The value for the key that ends at this depth hangs off one node of the chain.
+    JsonSlot * sa = _chain_value(a, baseA);
+    JsonSlot * sb = _chain_value(b, baseB);
+    JsonValue va = sa ? _slot_get(sa) : (JsonValue) { .type = JSON_NULL };
+    JsonValue vb = sb ? _slot_get(sb) : (JsonValue) { .type = JSON_NULL };
+    if (sa && sb)
+    {
+        _diff_JsonValue(d, depth, &va, &vb);
+    }
+    else if (sa)
+    {
+        _write_patch_op(d, "remove", depth, NULL);
+    }
+    else if (sb)
+    {
+        _write_patch_op(d, "add", depth, &vb);
+    }
+
+    // Keys that go on below here are longer than the key buffer holds.
+    if (depth >= JSON_KEY_LENGTH - 1)
+    {
+        d->failed = d->failed || _chain_continues(a) || _chain_continues(b);
+        return;
+    }
+
+    char * key = d->path + d->segments[d->nSegments];
+    for (u_int16_t offset = a; offset != DEFAULT_OBJECT_ADDRESS; )
+    {
+        JsonNode * x = (JsonNode *)(buffer->start + offset);
+        JsonNode * y = _chain_find(b, x->letter);
+        key[depth] = x->letter;
+        _diff_JsonNode(d, x->child, baseA, y ? y->child : DEFAULT_OBJECT_ADDRESS, baseB, depth + 1);
+        offset = x->sibling;
+    }
+
+    for (u_int16_t offset = b; offset != DEFAULT_OBJECT_ADDRESS; )
+    {
+        JsonNode * y = (JsonNode *)(buffer->start + offset);
+        if (!_chain_find(a, y->letter))
+        {
+            key[depth] = y->letter;
+            _diff_JsonNode(d, DEFAULT_OBJECT_ADDRESS, baseA, y->child, baseB, depth + 1);
+        }
+        offset = y->sibling;
+    }
+}
+
+void _diff_JsonObject(_Differ * d, JsonObject * a, JsonObject * b)
+{
+    u_int8_t * baseA, * baseB;
+    u_int16_t trieA = _key_trie(a, &baseA);
+    u_int16_t trieB = _key_trie(b, &baseB);
+    _diff_JsonNode(d, trieA, baseA, trieB, baseB, 0);
+}
+
+size_t diff_JsonObject(JsonObject * from, JsonObject * to, char * destination)
+{
+    _Differ d;
+    _init_dumper(&(d.dumper), d.key_buffer, sizeof(d.key_buffer), destination);
+    d.nSegments = 0;
+    d.segments[0] = 0;
+    d.first = true;
+    d.failed = false;
+
+    *(d.dumper.destination++) = '[';
+    _diff_JsonObject(&d, from, to);
+    if (d.failed)
+    {
+        *destination = '\0';
+        return 0;
+    }
+    *(d.dumper.destination++) = ']';
+    *(d.dumper.destination) = '\0';
+
+    return d.dumper.destination - destination;
+}
+
+// Array indices in a JSON pointer are digits without leading zeros.
+bool _parse_index(char * segment, int * index)
+{
+    if (!*segment || (segment[0] == '0' && segment[1]) || strlen(segment) > 5)
+    {
+        return false;
+    }
+
+    *index = 0;
+    for (char * c = segment; *c; c++)
+    {
+        if (*c < '0' || *c > '9') return false;
+        *index = *index * 10 + (*c - '0');
+    }
+    return true;
+}
+
+// Finds the slot a key or index refers to, inside an object or array value.
+JsonSlot * _child_JsonValue(JsonSlot * slot, char * segment)
+{
+    JsonValue container = _slot_get(slot);
+    if (container.type == JSON_OBJECT)
+    {
+        return _find_slot(container.data.o, segment);
+    }
+
+    int index;
+    if (container.type == JSON_ARRAY && _parse_index(segment, &index) && index < container.data.a->length)
+    {
+        return &((JsonSlot *)(buffer->start + container.data.a->elements))[index];
+    }
+    return NULL;
+}
+
+// Resolves all but the last segment of a JSON pointer. The last segment is
+// unescaped into key. Returns NULL for the empty pointer, or paths that do not exist.
+JsonSlot * _resolve_pointer(JsonSlot * root, char * path, char * key)
+{
+    JsonSlot * container = root;
+    if (*path != '/')
+    {
+        return NULL;
+    }
+
+    while (*path == '/')
+    {
+        char * k = key;
+        for (path++; *path && *path != '/'; path++)
+        {
+            if (k - key >= JSON_KEY_LENGTH - 1)
+            {
+                return NULL;
+            }
+
+            if (*path != '~')
+            {
+                *(k++) = *path;
+            }
+            else if (path[1] == '0' || path[1] == '1')
+            {
+                *(k++) = *(++path) == '0' ? '~' : '/';
+            }
+            else
+            {
+                return NULL;
+            }
+        }
+        *k = '\0';
+
+        if (*path == '/')
+        {
+            container = _child_JsonValue(container, key);
+            if (!container)
+            {
+                return NULL;
+            }
+        }
+    }
+
+    return container;
+}
+
+// Checks that key can be added to the value in slot, which must be an object,
+// or an array that key indexes at most one past the end of.
+bool _can_patch_add(JsonSlot * slot, char * key)
+{
+    if (!slot)
+    {
+        return false;
+    }
+
+    JsonValue container = _slot_get(slot);
+    int index;
+    return container.type == JSON_OBJECT ||
+        (container.type == JSON_ARRAY &&
+         (strcmp(key, "-") == 0 || (_parse_index(key, &index) && index <= container.data.a->length)));
+}
+
+bool _patch_add(JsonSlot * slot, char * key, JsonValue * value)
+{
+    if (!_can_patch_add(slot, key))
+    {
+        return false;
+    }
+
+    JsonValue container = _slot_get(slot);
+    if (container.type == JSON_OBJECT)
+    {
+        return _set_JsonValue(container.data.o, key, value);
+    }
+
+    // Arrays have a fixed size, so adding an element means making a new one.
+    JsonArray * array = container.data.a;
+    int index = array->length;
+    if (strcmp(key, "-") != 0)
+    {
+        _parse_index(key, &index);
+    }
+
+    JsonArray * grown = create_JsonArray(array->length + 1);
+    if (!grown)
+    {
+        return false;
+    }
+
+    JsonSlot * elements = (JsonSlot *)(buffer->start + array->elements);
+    JsonSlot * grownElements = (JsonSlot *)(buffer->start + grown->elements);
+    memcpy(grownElements, elements, sizeof(JsonSlot) * index);
+    memcpy(grownElements + index + 1, elements + index, sizeof(JsonSlot) * (array->length - index));
+    container.data.a = grown;
+    return _slot_set(&grownElements[index], *value, _json_pool()) && _slot_set(slot, container, _json_pool());
+}
+
+bool _patch_remove(JsonSlot * slot, char * key)
+{
+    JsonValue container = _slot_get(slot);
+    if (container.type == JSON_OBJECT)
+    {
+        return remove_value(container.data.o, key);
+    }
+
+    // Arrays shrink in place.
+    int index;
+    if (container.type != JSON_ARRAY || !_parse_index(key, &index) || index >= container.data.a->length)
+    {
+        return false;
+    }
+
+    JsonArray * array = container.data.a;
+    JsonSlot * elements = (JsonSlot *)(buffer->start + array->elements);
+    memmove(elements + index, elements + index + 1, sizeof(JsonSlot) * (array->length - index - 1));
+    array->length--;
+    return true;
+}
+
+bool _apply_JsonPatch_op(JsonSlot * root, char ** input)
+{
+    char key[JSON_KEY_LENGTH];
+    char op[JSON_KEY_LENGTH] = "";
+    char path[JSON_PATH_LENGTH];
+    char from[JSON_PATH_LENGTH];
+    bool hasPath = false, hasFrom = false, hasValue = false;
+    JsonValue value;
+
+    skip_JsonWhitespace(input);
+    if (**input != '{')
+    {
+        return false;
+    }
+    (*input)++;
+
+    // Members can come in any order.
+    do
+    {
+        skip_JsonWhitespace(input);
+        if (!scan_JsonString(input, key, sizeof(key)))
+        {
+            return false;
+        }
+        skip_JsonWhitespace(input);
+        if (*((*input)++) != ':')
+        {
+            return false;
+        }
+        skip_JsonWhitespace(input);
+
+        bool success;
+        if (strcmp(key, "op") == 0)
+        {
+            success = scan_JsonString(input, op, sizeof(op));
+        }
+        else if (strcmp(key, "path") == 0)
+        {
+            success = hasPath = scan_JsonString(input, path, sizeof(path));
+        }
+        else if (strcmp(key, "from") == 0)
+        {
+            success = hasFrom = scan_JsonString(input, from, sizeof(from));
+        }
+        else if (strcmp(key, "value") == 0)
+        {
+            success = hasValue = _parse_JsonValue_text(input, &value);
+        }
+        else
+        {
+            success = skip_JsonValue(input);
+        }
+
+        if (!success)
+        {
+            return false;
+        }
+        skip_JsonWhitespace(input);
+    } while (*((*input)++) == ',');
+
+    if ((*input)[-1] != '}' || !hasPath)
+    {
+        return false;
+    }
+
+    // Operations that read from another location turn into an add.
+    bool isMove = strcmp(op, "move") == 0;
+    if (isMove || strcmp(op, "copy") == 0)
+    {
+        size_t fromLength = hasFrom ? strlen(from) : 0;
+        if (!hasFrom || (isMove && strncmp(from, path, fromLength) == 0 && path[fromLength] == '/'))
+        {
+            return false;
+        }
+
+        char fromKey[JSON_KEY_LENGTH];
+        JsonSlot * fromContainer = _resolve_pointer(root, from, fromKey);
+        JsonSlot * source = fromContainer ? _child_JsonValue(fromContainer, fromKey) : NULL;
+        if (!source)
+        {
+            return false;
+        }
+
+        JsonValue sourceValue = _slot_get(source);
+        if (isMove)
+        {
+            // The target is checked before the source is removed. Removing can
+            // still shift the array indices on the target's path, so the source
+            // is put back if the add fails after all.
+            value = sourceValue;
+            if (path[0] != '\0')
+            {
+                if (!_can_patch_add(_resolve_pointer(root, path, key), key) || !_patch_remove(fromContainer, fromKey))
+                {
+                    return false;
+                }
+
+                JsonSlot * container = _resolve_pointer(root, path, key);
+                if (container && _patch_add(container, key, &value))
+                {
+                    return true;
+                }
+                _patch_add(fromContainer, fromKey, &value);
+                return false;
+            }
+            if (value.type != JSON_OBJECT || !_patch_remove(fromContainer, fromKey))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            // Copies must not share anything with the original, or later
+            // operations on one would show up in the other.
+            _Copier c = { .destination = buffer, .failed = false };
+            _copy_JsonValue(&c, &sourceValue, &value);
+            if (c.failed)
+            {
+                return false;
+            }
+        }
+        hasValue = true;
+        strcpy(op, "add");
+    }
+
+    // The empty path refers to the whole document.
+    if (path[0] == '\0')
+    {
+        JsonValue rootValue = _slot_get(root);
+        if (strcmp(op, "test") == 0)
+        {
+            return hasValue && _equal_JsonValue(&rootValue, &value);
+        }
+        if ((strcmp(op, "add") == 0 || strcmp(op, "replace") == 0) && hasValue && value.type == JSON_OBJECT)
+        {
+            rootValue.data.o->node = value.data.o->node;
+            return true;
+        }
+        return false;
+    }
+
+    JsonSlot * container = _resolve_pointer(root, path, key);
+    if (!container)
+    {
+        return false;
+    }
+
+    if (strcmp(op, "remove") == 0)
+    {
+        return _patch_remove(container, key);
+    }
+
+    if (!hasValue)
+    {
+        return false;
+    }
+
+    if (strcmp(op, "add") == 0)
+    {
+        return _patch_add(container, key, &value);
+    }
+
+    JsonSlot * target = _child_JsonValue(container, key);
+    if (strcmp(op, "replace") == 0 && target)
+    {
+        return _slot_set(target, value, _json_pool());
+    }
+    if (strcmp(op, "test") == 0 && target)
+    {
+        JsonValue targetValue = _slot_get(target);
+        return _equal_JsonValue(&targetValue, &value);
+    }
+
+    return false;
+}
+
+bool apply_JsonPatch(JsonObject * obj, char * patch)
+{
+    JsonSlot root;
+    _slot_set(&root, (JsonValue) { .type = JSON_OBJECT, .data.o = obj }, _json_pool());
+    skip_JsonWhitespace(&patch);
+    if (*(patch++) != '[')
+    {
+        return false;
+    }
+
+    skip_JsonWhitespace(&patch);
+    if (*patch == ']')
+    {
+        return true;
+    }
+
+    while (true)
+    {
+        if (!_apply_JsonPatch_op(&root, &patch))
+        {
+            return false;
+        }
+        skip_JsonWhitespace(&patch);
+        switch (*(patch++))
+        {
+            case ',':
+                break;
+            case ']':
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+// JSON Merge Patch (RFC 7396)
+bool _merge_JsonNode(u_int16_t * head, u_int16_t patch, u_int8_t * base, int depth);
+
+// Finds the node for letter in the chain starting at *head, adding it if it is missing.
+JsonNode * _chain_find_or_add(u_int16_t * head, unsigned char letter)
+{
+    if (*head == DEFAULT_OBJECT_ADDRESS)
+    {
+        JsonNode * node = _alloc_JsonNode(letter);
+        if (node)
+        {
+            *head = (u_int8_t *) node - buffer->start;
+        }
+        return node;
+    }
+
+    JsonNode * node = (JsonNode *)(buffer->start + *head);
+    if (node->letter == DEFAULT_LETTER)
+    {
+        // The root node of an empty object.
+        node->letter = letter;
+        return node;
+    }
+
+    while (node->letter != letter)
+    {
+        if (node->sibling == DEFAULT_OBJECT_ADDRESS)
+        {
+            JsonNode * sibling = _alloc_JsonNode(letter);
+            if (!sibling) return NULL;
+            node->sibling = (u_int8_t *) sibling - buffer->start;
+        }
+        node = (JsonNode *)(buffer->start + node->sibling);
+    }
+    return node;
+}
+
+// Merges the value of the key that ends at the target chain starting at *head.
+bool _merge_JsonValue(u_int16_t * head, int depth, JsonValue * patch)
+{
+    // Below the root, a key's value is held by the first node of the chain. The
+    // value of the empty key is held by the root chain's '\0' node.
+    JsonNode * node = depth ? NULL : _chain_find(*head, '\0');
+    if (depth && *head != DEFAULT_OBJECT_ADDRESS)
+    {
+        node = (JsonNode *)(buffer->start + *head);
+    }
+
+    if (patch->type == JSON_NULL)
+    {
+        if (node)
+        {
+            node->data = DEFAULT_OBJECT_ADDRESS;
+        }
+        return true;
+    }
+
+    if (!node)
+    {
+        node = _chain_find_or_add(head, '\0');
+        if (!node) return false;
+    }
+
+    JsonSlot * current = node->data != DEFAULT_OBJECT_ADDRESS ? (JsonSlot *)(buffer->start + node->data) : NULL;
+    JsonValue value = *patch;
+    if (patch->type == JSON_OBJECT)
+    {
+        JsonValue currentValue = current ? _slot_get(current) : (JsonValue) { .type = JSON_NULL };
+        if (currentValue.type == JSON_OBJECT)
+        {
+            return merge_patch(currentValue.data.o, patch->data.o);
+        }
+
+        // Merging into an empty object drops the patch's nulls, and keeps the
+        // target from sharing nodes with the patch.
+        value.data.o = create_JsonObject();
+        if (!value.data.o || !merge_patch(value.data.o, patch->data.o))
+        {
+            return false;
+        }
+    }
+
+    if (!current)
+    {
+        current = _json_alloc(sizeof(JsonSlot), alignof(JsonSlot), JSON_ALLOC_VALUE);
+        if (!current) return false;
+        node->data = (u_int8_t *) current - buffer->start;
+    }
+    return _slot_set(current, value, _json_pool());
+}
+
+// Merges the patch chain into the target chain starting at *head, one letter at
+// a time, so every key is merged without walking down from the root again.
+bool _merge_JsonNode(u_int16_t * head, u_int16_t patch, u_int8_t * base, int depth)
+{
+    JsonSlot * slot = _chain_value(patch, base);
+    JsonValue value = slot ? _slot_get(slot) : (JsonValue) { .type = JSON_NULL };
+    if (slot && !_merge_JsonValue(head, depth, &value))
+    {
+        return false;
+    }
+
+    for (u_int16_t offset = patch; offset != DEFAULT_OBJECT_ADDRESS; )
+    {
+        JsonNode * p = (JsonNode *)(buffer->start + offset);
+        if (p->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            JsonNode * t = _chain_find_or_add(head, p->letter);
+            if (!t || !_merge_JsonNode(&(t->child), p->child, base, depth + 1))
+            {
+                return false;
+            }
+        }
+        offset = p->sibling;
+    }
+    return true;
+}
+
+bool merge_patch(JsonObject * target, JsonObject * patch)
+{
+    // The target's trie is changed in place, so it cannot be a shared one.
+    if (_is_shaped(target) && !_unshape_JsonObject(target, _shape_length(target)))
+    {
+        return false;
+    }
+
+    u_int8_t * base;
+    u_int16_t head = (u_int8_t *) target - buffer->start;
+    u_int16_t trie = _key_trie(patch, &base);
+    return _merge_JsonNode(&head, trie, base, 0);
+}
+
+// Columnar export
+
+// Writes row of column from slot, which is NULL when the row has no such field.
+void _export_JsonColumn(JsonColumn * column, u_int16_t row, JsonSlot * slot)
+{
+    JsonValue value = { .type = JSON_NULL };
+    if (slot)
+    {
+        value = _slot_get(slot);
+    }
+
+    bool present = false;
+    double d = 0;
+    int64_t i = 0;
+    char * s = NULL;
+    switch (column->type)
+    {
+        case JSON_FLOAT:
+            present = get_double(value, &d);
+            ((float *) column->values)[row] = present ? d : 0;
+            break;
+        case JSON_DOUBLE:
+            present = get_double(value, &d);
+            ((double *) column->values)[row] = present ? d : 0;
             break;
-        case 'n':
-            *(parser->buffer++) = '\n';
+        case JSON_INT:
+            present = get_int(value, &i);
+            ((int64_t *) column->values)[row] = present ? i : 0;
             break;
-        case 'r':
-            *(parser->buffer++) = '\r';
+        case JSON_BOOL:
+            present = value.type == JSON_BOOL;
+            ((bool *) column->values)[row] = present && value.data.b;
             break;
-        case 't':
-            *(parser->buffer++) = '\t';
+        case JSON_STRING:
+            s = value.type == JSON_STRING ? _slot_string(slot) : NULL;
+            present = s != NULL;
+            ((char **) column->values)[row] = s;
             break;
         default:
-            return false;
+            break;
     }
 
-    return true;
+    if (column->nulls)
+    {
+        u_int8_t bit = 1 << (row % 8);
+        column->nulls[row / 8] = present ? column->nulls[row / 8] & ~bit : column->nulls[row / 8] | bit;
+    }
 }
 
-bool parse_JsonString(_Parser * parser)
+bool export_JsonColumns(JsonArray * array, JsonColumn * columns, int nColumns)
 {
-    #ifdef DEBUG_JSON
-    printf("Parsing string\n");
-    #endif
-    push_ptr(&parser->jsonBufferStack, parser->buffer);
-    while (*(parser->input))
+    if (nColumns > JSON_EXPORT_COLUMNS)
     {
-        switch (*(parser->input))
+        return false;
+    }
+    for (int c = 0; c < nColumns; c++)
+    {
+        JsonDataType type = columns[c].type;
+        if (type != JSON_FLOAT && type != JSON_DOUBLE && type != JSON_INT && type != JSON_BOOL && type != JSON_STRING)
         {
-            case '"':
-                *(parser->buffer++) = '\0';
-                pop_int(&parser->jsonParseStack);
-                next_token(parser);
-                return true;
-            case '\\':
-                if (!parse_EscapedChar(parser))
+            return false;
+        }
+    }
+
+    // Where each field sits in the vectors of objects with the last shape seen.
+    u_int16_t shape = DEFAULT_OBJECT_ADDRESS;
+    u_int16_t offsets[JSON_EXPORT_COLUMNS];
+
+    JsonSlot * elements = (JsonSlot *)(buffer->start + array->elements);
+    for (u_int16_t row = 0; row < array->length; row++)
+    {
+        JsonValue element = _slot_get(&elements[row]);
+        JsonObject * obj = element.type == JSON_OBJECT ? element.data.o : NULL;
+        if (obj && _is_shaped(obj))
+        {
+            if (obj->node.child != shape)
+            {
+                shape = obj->node.child;
+                for (int c = 0; c < nColumns; c++)
                 {
-                    return false;
+                    JsonNode * node = _find_JsonNode((JsonObject *)(buffer->start + shape), columns[c].key);
+                    offsets[c] = node ? node->data : DEFAULT_OBJECT_ADDRESS;
                 }
-                break;
-            default:
-                *(parser->buffer++) = *(parser->input);
+            }
+
+            u_int8_t * base = buffer->start + obj->node.data;
+            for (int c = 0; c < nColumns; c++)
+            {
+                JsonSlot * slot = offsets[c] != DEFAULT_OBJECT_ADDRESS ? (JsonSlot *)(base + offsets[c]) : NULL;
+                _export_JsonColumn(&columns[c], row, slot);
+            }
+        }
+        else
+        {
+            for (int c = 0; c < nColumns; c++)
+            {
+                _export_JsonColumn(&columns[c], row, obj ? _find_slot(obj, columns[c].key) : NULL);
+            }
         }
-        next_token(parser);
     }
-
     return true;
 }
 
-bool parse_Colon(_Parser * parser)
+// Parallel parsing
+
+// The region of the mempool that a slice parses into is this many times the size
+// of its input, which is more than most documents need, plus a little for the
+// objects every slice makes.
+#define JSON_SLICE_POOL_RATIO 3
+#define JSON_SLICE_POOL_SLACK 64
+
+typedef struct _ParseSlice
 {
-    #ifdef DEBUG_JSON
-    printf("Parsing colon\n");
-    #endif
-    skip_whitespace(parser);
-    switch (*(parser->input))
+    char * start;                   // The slice's first member or element
+    u_int16_t first;                // Index of the first element
+    u_int16_t count;                // Number of members or elements
+    bool members;
+    JsonArray * array;              // Where elements go, made before the slices are parsed
+    JsonObject * object;            // Where members go, made by the slice
+    JsonMempool pool;               // The slice's region of the active mempool
+    bool parsed;
+} _ParseSlice;
+
+// Counts the allocations of a slice's region in the mempool's stats.
+void _add_JsonMempoolStats(JsonMempoolStats * stats, JsonMempoolStats * region)
+{
+    stats->padding += region->padding;
+    stats->failed += region->failed;
+    for (int kind = 0; kind < JSON_ALLOC_KINDS; kind++)
     {
-        case ':':
-            pop_int(&parser->jsonParseStack);
-            next_token(parser);
-            break;
-        default:
-            return false;
+        stats->allocations[kind] += region->allocations[kind];
+        stats->bytes[kind] += region->bytes[kind];
     }
-
-    return true;
 }
 
-bool parse_JsonValue(_Parser * parser)
+// Splits the members or elements of the object or array at *input into at most
+// nSlices slices, cutting at the first one that starts past an even share of the
+// bytes left before end. Only the structure is scanned, since the slices are
+// checked as they are parsed. Leaves *input just past the container, and returns
+// the number of slices, or -1 if the container cannot be split.
+int _split_JsonContainer(char ** input, char * end, _ParseSlice * slices, int nSlices)
 {
-    #ifdef DEBUG_JSON
-    printf("Parsing json value\n");
-    #endif
-    skip_whitespace(parser);
-    pop_int(&parser->jsonParseStack);
-    switch (*(parser->input))
+    char * c = *input;
+    bool members = *c == '{';
+    char close = members ? '}' : ']';
+    char * cut = c;
+    int n = 0;
+    int index = 0;
+    c++;
+    skip_JsonWhitespace(&c);
+    while (*c != close)
     {
-        case '"':
-            next_token(parser);
-            push_int(&parser->jsonParseStack, Parse_JsonString);
-            parse_JsonString(parser);
-
-            enum JsonDeserializeTypes type = peek_int(&parser->jsonDeserializeStack);
-            if (type == Deserialize_JsonObject)
-            {
-                char* value = pop_ptr(&parser->jsonBufferStack);
-                parser->buffer = pop_ptr(&parser->jsonBufferStack);
-                JsonObject * o = peek_ptr(&parser->jsonObjectStack);
-                _set_value(o, parser->buffer, value, JSON_STRING);
-            }
-            else if (type == Deserialize_JsonArray)
-            {
-                // With arrays, the string is kept in the buffer. They will need to later be
-                // removed when the elemeent is added to the string.
-                char * value = peek_ptr(&parser->jsonBufferStack);
-                JsonValue * element = parser->arrayBuffer++;
-                element->type = JSON_STRING;
-                element->data.s = value;
-            }
-            break;
-        case 'n':
+        if (c >= cut && n < nSlices)
         {
-            for (unsigned long i = 0; i < sizeof(_JSON_NULL_STR) - 1; i++)
-            {
-                if (*(parser->input) != _JSON_NULL_STR[i]) return false;
-                next_token(parser);
-            }
+            slices[n] = (_ParseSlice) { .start = c, .first = index, .count = 0, .members = members };
+            n++;
+            cut = c + (end - c) / (nSlices - n + 1);
+        }
 
-            enum JsonDeserializeTypes type = peek_int(&parser->jsonDeserializeStack);
-            if (type == Deserialize_JsonObject)
-            {
-                JsonObject * o = peek_ptr(&parser->jsonObjectStack);
-                parser->buffer = pop_ptr(&parser->jsonBufferStack);
-                _set_value(o, parser->buffer, NULL, JSON_NULL);
-            }
-            else if (type == Deserialize_JsonArray)
-            {
-                JsonValue *element = parser->arrayBuffer++;
-                element->type = JSON_NULL;
-                element->data.n = NULL;
-            }
-            break;
+        // Arrays are held to the length of the array buffer, like parse_JsonObject does.
+        if (slices[n - 1].count == UINT16_MAX || (!members && index == JSON_ARRAY_BUFFER_LENGTH))
+        {
+            return -1;
         }
-        case 't':
+        if (members)
         {
-            for (unsigned long i = 0; i < sizeof(_JSON_TRUE_STR) - 1; i++)
-            {
-                if (*(parser->input) != _JSON_TRUE_STR[i]) return false;
-                next_token(parser);
-            }
-
-            enum JsonDeserializeTypes type = peek_int(&parser->jsonDeserializeStack);
-            if (type == Deserialize_JsonObject)
+            if (*c != '"' || !skip_JsonValue(&c))
             {
-                JsonObject *o = peek_ptr(&parser->jsonObjectStack);
-                parser->buffer = pop_ptr(&parser->jsonBufferStack);
-                bool temp = true;
-                _set_value(o, parser->buffer, &temp, JSON_BOOL);
+                return -1;
             }
-            else if (type == Deserialize_JsonArray)
+            skip_JsonWhitespace(&c);
+            if (*c != ':')
             {
-                JsonValue *element = parser->arrayBuffer++;
-                element->type = JSON_BOOL;
-                element->data.b = true;
+                return -1;
             }
-            break;
+            c++;
+            skip_JsonWhitespace(&c);
         }
-        case 'f':
+        if (!skip_JsonValue(&c))
         {
-            for (unsigned long i = 0; i < sizeof(_JSON_FALSE_STR) - 1; i++)
-            {
-                if (*(parser->input) != _JSON_FALSE_STR[i]) return false;
-                next_token(parser);
-            }
+            return -1;
+        }
+        slices[n - 1].count++;
+        index++;
 
-            enum JsonDeserializeTypes type = peek_int(&parser->jsonDeserializeStack);
-            if (type == Deserialize_JsonObject)
-            {
-                JsonObject * o = peek_ptr(&parser->jsonObjectStack);
-                parser->buffer = pop_ptr(&parser->jsonBufferStack);
-                bool temp = false;
-                _set_value(o, parser->buffer, &temp, JSON_BOOL);
-            }
-            else if (type == Deserialize_JsonArray)
+        skip_JsonWhitespace(&c);
+        if (*c == ',')
+        {
+            c++;
+            skip_JsonWhitespace(&c);
+            if (*c == close)
             {
-                JsonValue *element = parser->arrayBuffer++;
-                element->type = JSON_BOOL;
-                element->data.b = false;
+                return -1;
             }
-            break;
         }
-        case '0': case '1': case '2': case '3': case '4': case '5':
-        case '6': case '7': case '8': case '9': case '-':
-            push_int(&parser->jsonParseStack, Parse_JsonNumber);
-            break;
-        case '{':
-            push_int(&parser->jsonParseStack, Parse_JsonObjectStart);
-            break;
-        case '[':
-            push_int(&parser->jsonParseStack, Parse_JsonElements);
-            push_int(&parser->jsonDeserializeStack, Deserialize_JsonArray);
-            push_ptr(&parser->jsonObjectStack, parser->arrayBuffer);
-            next_token(parser);
-            break;
-        default:
-            return false;
+        else if (*c != close)
+        {
+            return -1;
+        }
     }
 
-    return true;
+    *input = c + 1;
+    return n;
 }
 
-bool parse_JsonValueSeparator(_Parser* parser)
+// Parses the members or elements of a slice, allocating from the slice's region.
+// Each must end where the pre-scan found it to, at a separator.
+void * _run_ParseSlice(void * argument)
 {
-    #ifdef DEBUG_JSON
-    printf("Parsing json value separator\n");
-    #endif
-    skip_whitespace(parser);
-    switch (*(parser->input))
+    _ParseSlice * slice = argument;
+    char stringBuffer[JSON_STRING_BUFFER_LENGTH];
+    JsonValue arrayBuffer[JSON_ARRAY_BUFFER_LENGTH];
+    _Parser parser;
+    _init_parser(&parser, slice->start, stringBuffer, arrayBuffer);
+    region = &(slice->pool);
+
+    slice->parsed = true;
+    if (slice->members)
     {
-        case '}':
-            pop_int(&parser->jsonParseStack);
-            return true;
-        case ',':
-            next_token(parser);
-            pop_int(&parser->jsonParseStack);
-            return true;
-        default:
-            return false;
+        slice->object = create_JsonObject();
+        slice->parsed = slice->object != NULL;
+        push_ptr(&parser.jsonObjectStack, slice->object);
+        push_int(&parser.jsonDeserializeStack, Deserialize_JsonObject);
     }
-}
-
-bool parse_JsonElementSeparator(_Parser* parser)
-{
-    #ifdef DEBUG_JSON
-    printf("Parsing json element separator\n");
-    #endif
-    skip_whitespace(parser);
-    switch (*(parser->input))
+    else
     {
-        case ']':
-            pop_int(&parser->jsonParseStack);
-            return true;
-        case ',':
-            next_token(parser);
-            pop_int(&parser->jsonParseStack);
-            return true;
-        default:
-            return false;
+        push_ptr(&parser.jsonObjectStack, arrayBuffer);
+        push_int(&parser.jsonDeserializeStack, Deserialize_JsonArray);
     }
-}
-
-bool parse_JsonNumber(_Parser *parser)
-{
-    #ifdef DEBUG_JSON
-    printf("Parsing json number\n");
-    #endif
-    // Parse the number using strtod
-    char * start = parser->input;
-    char * end = parser->input;
-    float val = strtod(start, &end);
-    parser->input = end;
 
-    enum JsonDeserializeTypes type = peek_int(&parser->jsonDeserializeStack);
-    if (type == Deserialize_JsonObject)
+    char close = slice->members ? '}' : ']';
+    for (u_int16_t i = 0; slice->parsed && i < slice->count; i++)
     {
-        JsonObject *o = peek_ptr(&parser->jsonObjectStack);
-        parser->buffer = pop_ptr(&parser->jsonBufferStack);
-        _set_value(o, parser->buffer, &val, JSON_FLOAT);
+        skip_whitespace(&parser);
+        push_int(&parser.jsonParseStack, Parse_JsonValue);
+        if (slice->members)
+        {
+            push_int(&parser.jsonParseStack, Parse_Colon);
+            push_int(&parser.jsonParseStack, Parse_JsonString);
+            next_token(&parser);
+        }
+        slice->parsed = _run_parser(&parser);
+        skip_whitespace(&parser);
+        slice->parsed = slice->parsed && (*(parser.input) == ',' || *(parser.input) == close);
+        next_token(&parser);
     }
-    else if (type == Deserialize_JsonArray)
+
+    if (slice->parsed && !slice->members)
     {
-        JsonValue* element = parser->arrayBuffer++;
-        element->type = JSON_FLOAT;
-        element->data.f = val;
+        slice->parsed = _fill_JsonArray(&parser, slice->array, slice->first, arrayBuffer);
     }
+    region = NULL;
+    return NULL;
+}
 
-    if (start == end)
+// Points the chain starting at *head at the values under the chain at offset,
+// adding any nodes it is missing in the order they come in. This walks the chains
+// like _merge_JsonNode, but takes the values over instead of merging copies of them.
+bool _stitch_JsonNode(u_int16_t * head, u_int16_t offset, int depth)
+{
+    // As in _merge_JsonValue, the first node of a chain below the root holds the
+    // value of its key, while at the root only the '\0' node holds one.
+    JsonNode * first = (JsonNode *)(buffer->start + offset);
+    if (depth && first->data != DEFAULT_OBJECT_ADDRESS)
     {
-        next_token(parser);
-        return false;
+        JsonNode * node = *head != DEFAULT_OBJECT_ADDRESS ?
+            (JsonNode *)(buffer->start + *head) : _chain_find_or_add(head, first->letter);
+        if (!node)
+        {
+            return false;
+        }
+        node->data = first->data;
     }
 
-    pop_int(&parser->jsonParseStack);
+    for (u_int16_t next = offset; next != DEFAULT_OBJECT_ADDRESS; )
+    {
+        JsonNode * p = (JsonNode *)(buffer->start + next);
+        JsonNode * t = NULL;
+        if ((!depth && p->data != DEFAULT_OBJECT_ADDRESS) || p->child != DEFAULT_OBJECT_ADDRESS)
+        {
+            if (!(t = _chain_find_or_add(head, p->letter)))
+            {
+                return false;
+            }
+        }
+        if (!depth && p->data != DEFAULT_OBJECT_ADDRESS)
+        {
+            t->data = p->data;
+        }
+        if (p->child != DEFAULT_OBJECT_ADDRESS && !_stitch_JsonNode(&(t->child), p->child, depth + 1))
+        {
+            return false;
+        }
+        next = p->sibling;
+    }
     return true;
 }
 
-void print_error(_Parser * parser, char * input)
+bool parse_JsonObject_parallel(char * input, JsonObject ** parsed, JsonParseError * error, int nThreads)
 {
-    const int inputLength = 50, maxLeadingChars = 40;
-    char *start = start = input < parser->input - maxLeadingChars ? parser->input - maxLeadingChars : input;
-
-    char erroneousInput[inputLength + 1];
-    strncpy(erroneousInput, start, inputLength);
-    erroneousInput[inputLength] = '\0';
+    *parsed = NULL;
+    if (nThreads > JSON_PARSE_THREADS)
+    {
+        nThreads = JSON_PARSE_THREADS;
+    }
 
-    char invalidTokenArrow[inputLength];
-    int badIndex = parser->input - start;
-    for (int i = 0; i < inputLength; i++)
+    // The root object is split into its members, unless its only member holds an
+    // object or an array, which is split instead.
+    _ParseSlice slices[JSON_PARSE_THREADS];
+    char * end = input + strlen(input);
+    char * root = input;
+    skip_JsonWhitespace(&root);
+    char * key = NULL;
+    char * container = root;
+    char * after = root;
+    int nSlices = -1;
+    if (*root == '{' && nThreads > 1)
     {
-        if (i < badIndex)
-        {
-            invalidTokenArrow[i] = ' ';
-        }
-        else if (i == badIndex)
+        char * c = root + 1;
+        skip_JsonWhitespace(&c);
+        char * member = c;
+        if (*c == '"' && skip_JsonValue(&c))
         {
-            invalidTokenArrow[i] = '^';
+            skip_JsonWhitespace(&c);
+            if (*c == ':')
+            {
+                c++;
+                skip_JsonWhitespace(&c);
+                container = after = c;
+                if ((*c == '{' || *c == '[') && (nSlices = _split_JsonContainer(&after, end, slices, nThreads)) >= 0)
+                {
+                    skip_JsonWhitespace(&after);
+                    if (*after == '}')
+                    {
+                        key = member;
+                        after++;
+                    }
+                }
+            }
         }
-        else
+
+        if (!key)
         {
-            invalidTokenArrow[i] = '\0';
-            break;
+            container = after = root;
+            nSlices = _split_JsonContainer(&after, end, slices, nThreads);
         }
     }
 
-    if (*(parser->input))
+    char * trailing = after;
+    skip_JsonWhitespace(&trailing);
+    char keyBuffer[JSON_STRING_BUFFER_LENGTH];
+    if (nSlices < 2 || *trailing || (key && !scan_JsonString(&key, keyBuffer, sizeof(keyBuffer))))
     {
-        char bad_char = *(parser->input);
-        printf(
-            CONSOLE_RED "Invalid token found at position %li: '%c' (%d)\n" CONSOLE_RESET,
-            parser->input - input,
-            bad_char, 
-            (int)bad_char);
+        return _parse_JsonObject(input, NULL, parsed, error, NULL, 0, NULL);
     }
-    else
+
+    // Elements go straight into their places in the array, so it is made first.
+    u_int8_t * top = buffer->top;
+    JsonArray * array = NULL;
+    if (*container == '[')
     {
-        printf(CONSOLE_RED "Unexpected end of input");
+        _ParseSlice * last = &slices[nSlices - 1];
+        if (!(array = create_JsonArray(last->first + last->count)))
+        {
+            return _parse_JsonObject(input, NULL, parsed, error, NULL, 0, NULL);
+        }
     }
-    printf(CONSOLE_RED "%s\n" CONSOLE_RESET, erroneousInput);
-    printf(CONSOLE_RED "%s\n" CONSOLE_RESET, invalidTokenArrow);
-}
 
-bool parse_JsonObject(char* input, JsonObject** parsed)
-{
-    *parsed = NULL;
-    char buffer[1024];
-    JsonValue arrayBuffer[1024];
-    _Parser parser;
-    parser.input = input;
-    parser.buffer = buffer;
-    parser.arrayBuffer = arrayBuffer;
-    parser.jsonParseStack.stacktop = -1;
-    parser.jsonObjectStack.stacktop = -1;
-    parser.jsonBufferStack.stacktop = -1;
-    parser.jsonDeserializeStack.stacktop = -1;
-
-    // Skip leading whitespace
-    skip_whitespace(&parser);
+    // Slices get regions one after the other, the last one getting the rest of the
+    // mempool.
+    u_int8_t * regionStart = buffer->top;
+    for (int i = 0; i < nSlices; i++)
+    {
+        size_t size = (size_t)((i + 1 < nSlices ? slices[i + 1].start : end) - slices[i].start) *
+            JSON_SLICE_POOL_RATIO + JSON_SLICE_POOL_SLACK;
+        slices[i].array = array;
+        slices[i].pool = *buffer;
+        memset(&slices[i].pool.stats, 0, sizeof(JsonMempoolStats));
+        slices[i].pool.top = regionStart;
+        if (i + 1 < nSlices && size < (size_t)(buffer->end - regionStart))
+        {
+            slices[i].pool.end = regionStart + size;
+        }
+        regionStart = slices[i].pool.end;
+    }
+    _run_slices(_run_ParseSlice, slices, sizeof(_ParseSlice), nSlices);
 
-    // Expect to start parsing an object.
-    push_int(&parser.jsonParseStack, Parse_JsonObjectStart);
-    while (parser.jsonParseStack.stacktop >= 0)
+    // The mempool goes on from the end of the last slice. Slices that outgrew their
+    // region are parsed again from there, since values can be anywhere in the mempool.
+    bool success = true;
+    buffer->top = slices[nSlices - 1].pool.top;
+    for (int i = 0; i < nSlices; i++)
     {
-        bool success = _parser_jump_table[peek_int(&parser.jsonParseStack)](&parser);
-        if (!success)
+        _add_JsonMempoolStats(&(buffer->stats), &(slices[i].pool.stats));
+        if (!slices[i].parsed && slices[i].pool.stats.failed && i + 1 < nSlices)
         {
-            print_error(&parser, input);
-            return false;
+            memset(&slices[i].pool.stats, 0, sizeof(JsonMempoolStats));
+            slices[i].pool.top = buffer->top;
+            slices[i].pool.end = buffer->end;
+            _run_ParseSlice(&slices[i]);
+            _add_JsonMempoolStats(&(buffer->stats), &(slices[i].pool.stats));
+            buffer->top = slices[i].pool.top;
         }
+        success = success && slices[i].parsed;
+    }
+    JsonMempoolStats * stats = &(buffer->stats);
+    if ((size_t)(buffer->top - buffer->start) > stats->high_water)
+    {
+        stats->high_water = buffer->top - buffer->start;
     }
 
-    *parsed = pop_ptr(&parser.jsonObjectStack);
+    // Later slices win over earlier ones for keys they share, like later members do.
+    JsonObject * object = slices[0].object;
+    for (int i = 1; success && !array && i < nSlices; i++)
+    {
+        u_int16_t head = (u_int8_t *) object - buffer->start;
+        success = _stitch_JsonNode(&head, (u_int8_t *) slices[i].object - buffer->start, 0);
+    }
+    if (success && key)
+    {
+        JsonObject * wrapper = create_JsonObject();
+        success = wrapper && (array ? set_value_array(wrapper, keyBuffer, array) : set_value_object(wrapper, keyBuffer, object));
+        object = wrapper;
+    }
 
-    #ifdef DEBUG_JSON
-    printf("%d\n", parser.jsonParseStack.stacktop);
-    printf("%d\n", parser.jsonObjectStack.stacktop);
-    printf("%d\n", parser.jsonBufferStack.stacktop);
-    printf("%d\n", parser.jsonDeserializeStack.stacktop);
-    printf("%li\n", parser.buffer - buffer);
-    printf("%li\n", parser.arrayBuffer - arrayBuffer);
-    #endif
+    // Whatever failed is parsed again in one piece, for the error or for lack of
+    // room in a region.
+    if (!success)
+    {
+        buffer->top = top;
+        return _parse_JsonObject(input, NULL, parsed, error, NULL, 0, NULL);
+    }
 
+    *parsed = object;
+    stats->last_parse_input = after - input;
+    stats->last_parse_used = buffer->top - top;
+    if (error)
+    {
+        error->code = JSON_PARSE_OK;
+    }
     return true;
 }
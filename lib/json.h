@@ -21,7 +21,9 @@ typedef enum
     JSON_FLOAT,
     JSON_OBJECT,
     JSON_ARRAY,
-    JSON_ERROR
+    JSON_ERROR,
+    JSON_INT,
+    JSON_DOUBLE
 } JsonDataType;
 
 typedef enum
@@ -31,21 +33,45 @@ typedef enum
     INDEX_OUT_OF_BOUNDS = -3
 } JsonError;
 
+// Defining JSON_INLINE_STRINGS, for the library and everything including this
+// header, keeps strings shorter than JSON_INLINE_STRING_LENGTH, counting the
+// terminator, in the value itself, flagged with JSON_VALUE_INLINE. data.s is then
+// only valid for longer strings, so code built with it reads strings with
+// get_string. Without it every string is allocated and data.s is always valid.
+#define JSON_INLINE_STRING_LENGTH 8
+#define JSON_VALUE_INLINE 1
+
 typedef struct JsonValue
 {
     JsonDataType type;
+    u_int8_t flags;
     union
     {
         void * n;
         char* s;
+        char inline_s[JSON_INLINE_STRING_LENGTH];
         bool b;
         float f;
+        int64_t i;
+        double d;
         struct JsonObject* o;
         struct JsonArray * a;
         JsonError e;
     } data;
 } JsonValue;
 
+// Values are kept in the mempool as slots. By default a slot is a JsonValue.
+// Defining JSON_COMPACT_VALUES, for the library and everything including this
+// header, makes a slot an 8 byte NaN-boxed word instead: doubles are stored as
+// they are, other types are tagged NaNs holding a float, an integer of up to
+// 48 bits or a mempool offset. Larger integers are boxed in the mempool, and
+// strings are never inline. Slots are decoded into JsonValues on every read.
+#ifdef JSON_COMPACT_VALUES
+typedef u_int64_t JsonSlot;
+#else
+typedef JsonValue JsonSlot;
+#endif
+
 typedef struct JsonArray {
     u_int16_t length;
     u_int16_t elements;
@@ -64,35 +90,310 @@ typedef struct JsonObject
     JsonNode node;
 } JsonObject;
 
+typedef enum
+{
+    JSON_ALLOC_OBJECT,
+    JSON_ALLOC_NODE,
+    JSON_ALLOC_VALUE,
+    JSON_ALLOC_STRING,
+    JSON_ALLOC_ARRAY,
+    JSON_ALLOC_ELEMENTS,
+    JSON_ALLOC_BULK,        // Whole subtrees copied by clone_into
+    JSON_ALLOC_KINDS
+} JsonAllocKind;
+
+typedef struct JsonMempoolStats
+{
+    size_t size;                            // Size of the mempool
+    size_t used;                            // Bytes in use, including padding
+    size_t high_water;                      // Most bytes ever in use, kept across resets
+    size_t padding;                         // Bytes lost to alignment
+    size_t failed;                          // Allocations that did not fit
+    size_t allocations[JSON_ALLOC_KINDS];   // Allocation counts, indexed by JsonAllocKind
+    size_t bytes[JSON_ALLOC_KINDS];         // Bytes requested, indexed by JsonAllocKind
+    size_t last_parse_input;                // Input bytes read by the last successful parse
+    size_t last_parse_used;                 // Mempool bytes used by the last successful parse
+} JsonMempoolStats;
+
+typedef struct JsonMempool
+{
+    u_int8_t * start;
+    u_int8_t * end;
+    u_int8_t * top;
+    JsonMempoolStats stats;
+} JsonMempool;
+
 // Sets the beginning and end of the memory allocate for the JSON object
 void Json_set_mempool(void * start, size_t size);
 
+// For keeping several mempools. Objects are always created in, and read from, the
+// active mempool, which is the one set by Json_set_mempool until another is used.
+void Json_init_mempool(JsonMempool * pool, void * start, size_t size);
+void Json_use_mempool(JsonMempool * pool);
+JsonMempool * Json_get_mempool(void);
+
 // Resets the mempool, allowing it to be fully used again.
 void Json_reset_mempool();
 
+// Marks how much of the active mempool is in use, so that whatever is allocated
+// after the mark can be released while everything before it stays. Releasing
+// fails for a mark of another mempool, or one past what is in use. Objects from
+// before the mark that were changed after it may hold nodes and values from after
+// it, so they must not be used once it is released.
+typedef struct JsonMempoolMark
+{
+    JsonMempool * pool;
+    size_t used;
+} JsonMempoolMark;
+
+JsonMempoolMark Json_mempool_mark(void);
+bool Json_mempool_release(JsonMempoolMark mark);
+
+// Copies out the mempool's usage since the last reset.
+void Json_get_mempool_stats(JsonMempoolStats * stats);
+
 // Functions for creating json objects
 JsonObject * create_JsonObject(void);
 JsonValue get_value(JsonObject * obj, char * key);
+char * get_value_string(JsonObject * obj, char * key);
 bool set_value_null(JsonObject * obj, char * key);
 bool set_value_string(JsonObject * obj, char * key, char * str);
 bool set_value_bool(JsonObject * obj, char * key, bool data);
 bool set_value_float(JsonObject * obj, char * key, float data);
+bool set_value_int(JsonObject * obj, char * key, int64_t data);
+bool set_value_double(JsonObject * obj, char * key, double data);
 bool set_value_object(JsonObject * obj, char * key, JsonObject * object);
 bool set_value_array(JsonObject * obj, char * key, JsonArray * array);
+bool remove_value(JsonObject * obj, char * key);
+
+// Iterating over the keys and values of an object, without allocating. Keys are
+// written to a caller-provided buffer, and are valid until the next call.
+// Keys longer than the buffer (or JSON_KEY_LENGTH) are skipped.
+#define JSON_KEY_LENGTH 256
+typedef struct JsonObjectIterator
+{
+    u_int16_t nodes[JSON_KEY_LENGTH + 1];   // Pending trie nodes, as mempool offsets
+    u_int16_t depths[JSON_KEY_LENGTH + 1];  // Length of the key above each pending node
+    int top;
+    int terminated;                         // Where the last key's terminator was written
+    char terminated_letter;
+    char * key_buffer;
+    size_t key_buffer_size;
+    u_int8_t * base;                        // What the data offsets of nodes are relative to
+    #ifdef JSON_COMPACT_VALUES
+    JsonValue value;                        // The last value, decoded from its slot
+    #endif
+} JsonObjectIterator;
+
+void obj_iter_begin(JsonObjectIterator * it, JsonObject * obj, char * key_buffer, size_t size);
+bool obj_iter_next(JsonObjectIterator * it, char ** key, size_t * length, JsonValue ** value);
+
+// Deep copies obj, which must be in the active mempool, into destination. The
+// copy can be read once destination is made active. Returns NULL if it does not fit.
+JsonObject * clone_into(JsonMempool * destination, JsonObject * obj);
+
+// Copies a finished object into destination, laid out for reading: siblings are
+// contiguous, values sit next to their nodes, and strings are packed together.
+// The copy must not be modified. Reads resolve offsets through the active mempool,
+// which is shared by every thread, so threads can only read the copy at the same
+// time while destination stays active and none of them allocates or switches
+// mempools. Returns NULL if destination runs out of memory.
+JsonObject * freeze(JsonMempool * destination, JsonObject * obj);
 
 // Function for creating json arrays
 JsonArray * create_JsonArray(u_int16_t length);
 JsonValue get_element(JsonArray * j, u_int16_t index);
+char * get_element_string(JsonArray * j, u_int16_t index);
 bool set_element_null(JsonArray * j, u_int16_t index);
 bool set_element_string(JsonArray * j, u_int16_t index, char * str);
 bool set_element_bool(JsonArray * j, u_int16_t index, bool data);
 bool set_element_float(JsonArray * j, u_int16_t index, float data);
+bool set_element_int(JsonArray * j, u_int16_t index, int64_t data);
+bool set_element_double(JsonArray * j, u_int16_t index, double data);
 bool set_element_object(JsonArray * j, u_int16_t index, JsonObject * object);
 bool set_element_array(JsonArray * j, u_int16_t index, JsonArray * array);
 
+// Returns a string value's characters, which live as long as the value does, or
+// NULL if the value is not a string.
+char * get_string(JsonValue * value);
+
+// Reading numbers whatever their type. The parser stores numbers without a fraction
+// or exponent as JSON_INT when they fit, and everything else as JSON_DOUBLE.
+// get_int fails for values that are not whole numbers within range.
+bool get_int(JsonValue value, int64_t * out);
+bool get_double(JsonValue value, double * out);
+
+#ifdef JSON_PROFILE
+// Parser instrumentation, only compiled in when JSON_PROFILE is defined. Counts
+// are kept per thread, so they leave out the slices that parse_JsonObject_parallel
+// hands to other threads.
+#define JSON_PARSE_STATES 9
+typedef struct JsonProfile
+{
+    unsigned long parses;
+    unsigned long dispatches[JSON_PARSE_STATES];    // Indexed by parse state, see Json_parse_state_name
+    unsigned long whitespace_bytes;
+    unsigned long escapes;
+    unsigned long numbers;
+    int peak_depth[4];                              // Parse, object, buffer and deserialize stacks
+    unsigned long long string_cycles;
+    unsigned long long number_cycles;
+    unsigned long long tree_cycles;                 // Time spent in _set_value and building arrays
+} JsonProfile;
+
+void Json_get_profile(JsonProfile * profile);
+void Json_reset_profile(void);
+const char * Json_parse_state_name(int state);
+#endif
+
 // For dumping and parsing
 bool parse_JsonObject(char* input, JsonObject** parsed);
 size_t dump_JsonObject(JsonObject *o, char* destination);
 
+// Dumps the same bytes as dump_JsonObject, using up to nThreads threads (at most
+// JSON_DUMP_THREADS). The members of the root object are split into slices, one
+// per thread. While an object has a single member holding an object or array,
+// that value is split instead. The slices are measured, then cut again to hold
+// about the same number of bytes, and each thread writes its slice directly into
+// its part of destination.
+#define JSON_DUMP_THREADS 16
+size_t dump_JsonObject_parallel(JsonObject *o, char* destination, int nThreads);
+
+// Parse errors are reported through JsonParseError instead of being printed.
+// Offsets count bytes from the start of the input. Lines and columns start at 1.
+typedef enum JsonParseErrorCode
+{
+    JSON_PARSE_OK,
+    JSON_PARSE_UNEXPECTED_TOKEN,
+    JSON_PARSE_UNEXPECTED_END,
+    JSON_PARSE_INVALID_ESCAPE,
+    JSON_PARSE_INVALID_NUMBER,
+    JSON_PARSE_LIMIT_EXCEEDED,      // Nesting, string or array buffers of the parser are full
+    JSON_PARSE_OUT_OF_MEMORY,
+    JSON_PARSE_STOPPED,             // A JsonHandler callback returned false
+    JSON_PARSE_INVALID_UTF8,        // A string holds a malformed multi-byte character
+    JSON_PARSE_IO_ERROR,            // parse_JsonFile could not open or map the file
+} JsonParseErrorCode;
+
+typedef struct JsonParseError
+{
+    JsonParseErrorCode code;
+    size_t offset;
+    int line;
+    int column;
+    const char * expected;          // What the parser was looking for, such as "':'"
+} JsonParseError;
+
+bool parse_JsonObject_with_error(char* input, JsonObject** parsed, JsonParseError * error);
+void print_JsonParseError(char * input, JsonParseError * error);
+
+// Parses the file at path, which must hold nothing but a JSON object and
+// whitespace. The file is mapped and parsed in place instead of being copied
+// into a buffer, with a zeroed page after it as the terminator the parser reads
+// up to, so a NUL inside the file is reported as an unexpected token at its
+// offset. error can be NULL.
+bool parse_JsonFile(const char * path, JsonObject ** parsed, JsonParseError * error);
+
+// Parses input like parse_JsonObject_with_error, using up to nThreads threads (at
+// most JSON_PARSE_THREADS). A structural pre-scan splits the members of the root
+// object into slices of about the same size, or the members or elements of its
+// value when the root has a single member holding an object or an array. Each
+// thread parses a slice into a region of its own of the active mempool, sized
+// from the slice's input, and the slices are then stitched into one tree. The
+// unused end of every region but the last is lost until the mempool is reset, as
+// is the region of a slice that outgrows it and is parsed again after the others.
+// Input that cannot be split, or fails to parse this way, is parsed in one piece,
+// so errors are reported the same.
+#define JSON_PARSE_THREADS 16
+bool parse_JsonObject_parallel(char * input, JsonObject ** parsed, JsonParseError * error, int nThreads);
+
+// Event based parsing. Instead of building an object, each piece of the input is
+// handed to a callback as it is parsed, and nothing is allocated from the mempool.
+// Strings are only valid during their callback. Callbacks return false to stop
+// parsing, and any of them can be NULL. Integers go to on_number when on_integer
+// is NULL. Like every parser here, keys and strings are unescaped into a buffer
+// of JSON_STRING_BUFFER_LENGTH bytes before their callback, and one that does not
+// fit with its terminator fails with JSON_PARSE_LIMIT_EXCEEDED.
+#define JSON_STRING_BUFFER_LENGTH 1024
+typedef struct JsonHandler
+{
+    void * context;
+    bool (*on_object_start)(void * context);
+    bool (*on_object_end)(void * context);
+    bool (*on_array_start)(void * context);
+    bool (*on_array_end)(void * context);
+    bool (*on_key)(void * context, char * key, size_t length);
+    bool (*on_string)(void * context, char * str, size_t length);
+    bool (*on_number)(void * context, double value);
+    bool (*on_bool)(void * context, bool value);
+    bool (*on_null)(void * context);
+    bool (*on_integer)(void * context, int64_t value);
+} JsonHandler;
+
+bool parse_JsonEvents(char* input, JsonHandler * handler, JsonParseError * error);
+
+// Parses only the members on or below the given JSON pointers, such as "/user/name".
+// Everything else is skipped without being stored. Arrays are kept or skipped
+// whole. At most JSON_PROJECTION_PATHS paths can be given, and none of them may
+// be an invalid pointer, such as one with a '~' not followed by '0' or '1'.
+#define JSON_PROJECTION_PATHS 63
+bool parse_JsonObject_projected(char* input, char ** paths, int nPaths, JsonObject** parsed);
+
+// Checks that the first length bytes of input are a valid JSON object, without
+// allocating or building anything. Works without a mempool.
+bool validate_Json(char * input, size_t length);
+
+// Structural hash and deep equality. The hash does not depend on the order keys
+// were inserted in. Neither allocates from the mempool.
+u_int64_t json_hash(JsonObject * obj, u_int64_t seed);
+bool json_equal(JsonObject * a, JsonObject * b);
+
+// JSON Patch (RFC 6902). diff_JsonObject writes the patch that turns from into to,
+// and returns the number of bytes written, or 0 with destination left empty if
+// either has a key of JSON_KEY_LENGTH characters or more. apply_JsonPatch applies
+// a patch in place. Operations before a failing one stay applied.
+size_t diff_JsonObject(JsonObject * from, JsonObject * to, char * destination);
+bool apply_JsonPatch(JsonObject * obj, char * patch);
+
+// JSON Merge Patch (RFC 7396). Merges patch into target in place: keys set to null
+// are removed, objects are merged recursively, and anything else replaces the
+// target's value. Values other than objects are shared with the patch, not copied.
+bool merge_patch(JsonObject * target, JsonObject * patch);
+
+// Columnar export. Fills one caller-provided buffer per field with that field of
+// every element of an array of objects, one row per element. values holds a
+// float, int64_t, double, bool or char * per row, for JSON_FLOAT, JSON_INT,
+// JSON_DOUBLE, JSON_BOOL and JSON_STRING columns. Numbers are converted as by
+// get_double and get_int, and strings point into the mempool. Bit row % 8 of
+// nulls[row / 8] is set for rows where the field is missing, null, of another
+// type or not an object, and their value is zeroed; nulls can be NULL. Objects
+// sharing a shape have their fields looked up once. At most JSON_EXPORT_COLUMNS
+// columns can be given.
+#define JSON_EXPORT_COLUMNS 64
+typedef struct JsonColumn
+{
+    char * key;
+    JsonDataType type;
+    void * values;
+    u_int8_t * nulls;
+} JsonColumn;
+
+bool export_JsonColumns(JsonArray * array, JsonColumn * columns, int nColumns);
+
+// Scanners shared by the parser and by code emitted from generator.c. Each
+// advances *input past what it consumed, and returns false on malformed input.
+void skip_JsonWhitespace(char ** input);
+bool scan_JsonString(char ** input, char * destination, size_t size);
+bool scan_JsonNumber(char ** input, float * value);
+bool scan_JsonInt(char ** input, int64_t * value);
+bool scan_JsonDouble(char ** input, double * value);
+bool skip_JsonValue(char ** input);
+
+// Writers shared by the dumper and generated code. Return the number of bytes written.
+size_t dump_JsonString(char * str, char * destination);
+size_t dump_JsonFloat(float f, char * destination);
+size_t dump_JsonInt(int64_t i, char * destination);
+size_t dump_JsonDouble(double d, char * destination);
+
 #endif
 
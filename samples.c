@@ -4,27 +4,49 @@
 #include "lib/json.h"
 
 #define MEMPOOL_SIZE 65536
+
+// Reads a whole file into a terminated buffer, or returns NULL.
+char* read_file(char* filename)
+{
+    FILE * file = fopen(filename, "r");
+    if (!file)
+    {
+        return NULL;
+    }
+
+    char* inBuffer = malloc(MEMPOOL_SIZE);
+    int c = 0, i = 0;
+    while (i < MEMPOOL_SIZE - 1 && (c = getc(file)) != EOF)
+    {
+        inBuffer[i++] = c;
+    }
+    inBuffer[i] = '\0';
+    fclose(file);
+    return inBuffer;
+}
+
 void parse_file(char* filename)
 {   
-    char* inBuffer = malloc(MEMPOOL_SIZE);
-    char* outBuffer;
-    FILE * file = fopen(filename, "r");
-    if (file)
+    char* outBuffer = malloc(MEMPOOL_SIZE);
+
+    // Parse the file
+    JsonObject *parsed;
+    JsonParseError error;
+    bool success = parse_JsonFile(filename, &parsed, &error);
+    if (!success)
     {
-        int c = 0, i = 0;
-        while ((c = getc(file)) != EOF)
+        // The mapping is gone by now, so read the file again to show the error in context.
+        char* inBuffer = read_file(filename);
+        if (inBuffer && error.code != JSON_PARSE_IO_ERROR)
         {
-            inBuffer[i++] = c;
+            print_JsonParseError(inBuffer, &error);
         }
-        inBuffer[i++] = '\0';
-        outBuffer = malloc(i);
-        fclose(file);
+        else
+        {
+            printf("%s: error %d at line %d, column %d\n", filename, error.code, error.line, error.column);
+        }
+        free(inBuffer);
     }
-    printf("Input:\n%s\n", inBuffer);
-
-    // Parse the input
-    JsonObject *parsed;
-    bool success = parse_JsonObject(inBuffer, &parsed);
     assert(success);
 
     // Dump the object
@@ -32,7 +54,6 @@ void parse_file(char* filename)
     assert(success);
     printf("Output:\n%s\n", outBuffer);
 
-    free(inBuffer);
     free(outBuffer);
 }
 
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "lib/json.h"
 
@@ -91,7 +92,7 @@ void test_construction()
 
     set_value_string(j, "good", "wurd");
     jd = get_value(j, "good");
-    assert(strcmp(jd.data.s, "wurd") == 0);
+    assert(strcmp(get_string(&jd), "wurd") == 0);
 
     dump_JsonObject(j, buffer);
     printf("%s\n", buffer);
@@ -131,13 +132,31 @@ void test_arrays()
     assert(jd.data.n == NULL);
 
     jd = get_element(array, 4);
-    assert(strcmp(jd.data.s, "henlo world") == 0);
+    assert(strcmp(get_string(&jd), "henlo world") == 0);
 
     char buffer[256];
     dump_JsonObject(o, buffer);
     printf("%s\n", buffer);
 }
 
+void test_element_bounds()
+{
+    printf("\nTESTING ELEMENT BOUNDS\n");
+    JsonArray * array = create_JsonArray(2);
+    assert(set_element_int(array, 0, 7));
+    assert(set_element_string(array, 1, "last"));
+    assert(get_element(array, 0).data.i == 7);
+    assert(strcmp(get_element_string(array, 1), "last") == 0);
+
+    // Reading at or past the end is an error, not whatever follows the array.
+    JsonValue jd = get_element(array, 2);
+    assert(jd.type == JSON_ERROR && jd.data.e == INDEX_OUT_OF_BOUNDS);
+    assert(get_element_string(array, 2) == NULL);
+
+    JsonArray * empty = create_JsonArray(0);
+    assert(get_element(empty, 0).type == JSON_ERROR);
+}
+
 void test_nesting()
 {
     printf("\nTESTING NESTING\n");
@@ -190,14 +209,14 @@ void test_nesting()
     assert(jd.data.n == NULL);
 
     jd = get_element(array, 4);
-    assert(strcmp(jd.data.s, "henlo world") == 0);
+    assert(strcmp(get_string(&jd), "henlo world") == 0);
 
     // Test for first element in array
     piObj = get_element(arrayOuter, 1).data.o;
     array = get_value(piObj, "pi").data.a;
 
-    jd = get_element(array, 1);
-    assert(fabs(jd.data.f - f1) > 0.0000000001);
+    jd = get_element(array, 0);
+    assert(fabs(jd.data.f - f1) < 0.0000000001);
 
     char buffer[256];
     dump_JsonObject(o, buffer);
@@ -255,6 +274,26 @@ void test_printing()
     assert(strcmp(buffer, expected2) == 0);
 }
 
+void test_printing_key_prefixes()
+{
+    printf("\nTESTING PRINTING KEY PREFIXES\n");
+    // Keys after a nested object keep the prefix they share with its key.
+    char* inputs[] = {
+        "{\"ab\":{\"xy\":1},\"abc\":2}",
+        "{\"a\":{\"b\":{\"c\":1},\"bd\":2},\"ad\":[{\"k\":1},{\"kl\":{}}],\"adz\":3}",
+        "{\"ab\":[{\"xy\":1},{\"xz\":2}],\"abc\":true,\"b\":{\"ab\":{\"\":null},\"abd\":0}}",
+    };
+    char buffer[256];
+    for (int i = 0; i < 3; i++)
+    {
+        JsonObject* parsed;
+        assert(parse_JsonObject(inputs[i], &parsed));
+        dump_JsonObject(parsed, buffer);
+        printf("%s\n", buffer);
+        assert(strcmp(buffer, inputs[i]) == 0);
+    }
+}
+
 void test_parsing()
 {
     char buffer[256];
@@ -304,12 +343,1347 @@ void test_parsing()
     assert(strcmp(buffer, expected5) == 0);
 }
 
+void test_scanners()
+{
+    printf("\nTESTING SCANNERS\n");
+    char buffer[256];
+
+    char* input = "  \"esc\\\"aped\\n\" rest";
+    skip_JsonWhitespace(&input);
+    assert(scan_JsonString(&input, buffer, sizeof(buffer)));
+    assert(strcmp(buffer, "esc\"aped\n") == 0);
+    assert(strcmp(input, " rest") == 0);
+
+    // Strings that do not fit in the destination are rejected.
+    input = "\"toolong\"";
+    assert(!scan_JsonString(&input, buffer, 4));
+
+    float f;
+    input = "-12.5e1,";
+    assert(scan_JsonNumber(&input, &f));
+    assert(f == -125);
+    assert(*input == ',');
+
+    input = "{\"a\": [1, \"]}\", {\"b\": null}]}, \"next\"";
+    assert(skip_JsonValue(&input));
+    assert(strcmp(input, ", \"next\"") == 0);
+
+    input = "true}";
+    assert(skip_JsonValue(&input));
+    assert(*input == '}');
+
+    input = "[1, 2";
+    assert(!skip_JsonValue(&input));
+
+    size_t n = dump_JsonString("hi", buffer);
+    n += dump_JsonFloat(2.5, buffer + n);
+    buffer[n] = '\0';
+    assert(strcmp(buffer, "\"hi\"2.5") == 0);
+}
+
+void test_mempool_stats()
+{
+    printf("\nTESTING MEMPOOL STATS\n");
+    JsonMempoolStats stats;
+    Json_get_mempool_stats(&stats);
+    assert(stats.used == 0);
+    assert(stats.allocations[JSON_ALLOC_NODE] == 0);
+
+    JsonObject* o = create_JsonObject();
+    set_value_string(o, "ab", "str");
+    JsonArray* a = create_JsonArray(2);
+    set_value_array(o, "b", a);
+
+    Json_get_mempool_stats(&stats);
+    assert(stats.allocations[JSON_ALLOC_OBJECT] == 1);
+    assert(stats.allocations[JSON_ALLOC_NODE] == 4);  // "ab": b, \0 then "b": b, \0
+    assert(stats.allocations[JSON_ALLOC_VALUE] == 2);
+    #if defined(JSON_INLINE_STRINGS) && !defined(JSON_COMPACT_VALUES)
+    // Strings of up to seven bytes are kept in the value, not allocated.
+    assert(stats.allocations[JSON_ALLOC_STRING] == 0);
+    #else
+    assert(stats.allocations[JSON_ALLOC_STRING] == 1);
+    assert(stats.bytes[JSON_ALLOC_STRING] == 4);
+    #endif
+    assert(stats.allocations[JSON_ALLOC_ARRAY] == 1);
+    assert(stats.bytes[JSON_ALLOC_ELEMENTS] == 2 * sizeof(JsonSlot));
+
+    size_t requested = stats.padding;
+    for (int i = 0; i < JSON_ALLOC_KINDS; i++) requested += stats.bytes[i];
+    assert(requested == stats.used);
+    assert(stats.high_water >= stats.used);
+
+    // Allocations that do not fit fail without using the pool.
+    size_t used = stats.used;
+    assert(create_JsonArray(UINT16_MAX) == NULL);
+    Json_get_mempool_stats(&stats);
+    assert(stats.failed == 1);
+    assert(stats.used == used);
+    requested = stats.padding;
+    for (int i = 0; i < JSON_ALLOC_KINDS; i++) requested += stats.bytes[i];
+    assert(requested == stats.used);
+
+    Json_reset_mempool();
+    char* input = "{\"key\": [1, 2, 3]}  ";
+    JsonObject* parsed;
+    parse_JsonObject(input, &parsed);
+    Json_get_mempool_stats(&stats);
+    assert(stats.failed == 0);
+    assert(stats.high_water > stats.used);
+    assert(stats.last_parse_input == strlen(input) - 2);
+    assert(stats.last_parse_used == stats.used);
+    printf("%zu pool bytes for %zu input bytes\n", stats.last_parse_used, stats.last_parse_input);
+}
+
+void test_iterator()
+{
+    printf("\nTESTING ITERATOR\n");
+    char keyBuffer[JSON_KEY_LENGTH];
+    JsonObjectIterator it;
+    char* key;
+    size_t length;
+    JsonValue* value;
+
+    JsonObject* empty = create_JsonObject();
+    obj_iter_begin(&it, empty, keyBuffer, sizeof(keyBuffer));
+    assert(!obj_iter_next(&it, &key, &length, &value));
+
+    JsonObject* inner = create_JsonObject();
+    JsonObject* o = create_JsonObject();
+    set_value_float(o, "hello", 1);
+    set_value_float(o, "hell", 2);
+    set_value_string(o, "", "empty");
+    set_value_object(o, "inner", inner);
+    set_value_bool(o, "hello", true);
+
+    // Keys come out in the same order as dump_JsonObject writes them.
+    const char* expectedKeys[] = { "hell", "hello", "", "inner" };
+    int count = 0;
+    obj_iter_begin(&it, o, keyBuffer, sizeof(keyBuffer));
+    while (obj_iter_next(&it, &key, &length, &value))
+    {
+        printf("%s\n", key);
+        assert(strcmp(key, expectedKeys[count]) == 0);
+        assert(length == strlen(expectedKeys[count]));
+        count++;
+    }
+    assert(count == 4);
+
+    obj_iter_begin(&it, o, keyBuffer, sizeof(keyBuffer));
+    assert(obj_iter_next(&it, &key, &length, &value));
+    assert(value->type == JSON_FLOAT && value->data.f == 2);
+    assert(obj_iter_next(&it, &key, &length, &value));
+    assert(value->type == JSON_BOOL && value->data.b);
+
+    // Keys that do not fit in the buffer are skipped.
+    obj_iter_begin(&it, o, keyBuffer, 5);
+    count = 0;
+    while (obj_iter_next(&it, &key, &length, &value)) count++;
+    assert(count == 2);
+}
+
+void test_clone()
+{
+    printf("\nTESTING CLONE\n");
+    char buffer[256];
+    char persistentMemory[1024];
+    JsonMempool persistent;
+    Json_init_mempool(&persistent, persistentMemory, sizeof(persistentMemory));
+    JsonMempool* scratch = Json_get_mempool();
+
+    // Parsed subtrees are contiguous, so they are copied in bulk.
+    JsonObject* parsed;
+    parse_JsonObject("{\"id\": 1, \"payload\": {\"name\": \"abc\", \"list\": [1, \"two\", {\"x\": null}]}}", &parsed);
+    JsonObject* payload = clone_into(&persistent, get_value(parsed, "payload").data.o);
+    assert(payload);
+    assert(persistent.stats.allocations[JSON_ALLOC_BULK] == 1);
+
+    // Built by hand with other allocations in between, the copy is done piece by piece.
+    JsonObject* sparse = create_JsonObject();
+    create_JsonArray(20);
+    set_value_string(sparse, "s", "str");
+    create_JsonArray(20);
+    set_value_object(sparse, "o", create_JsonObject());
+    JsonObject* sparseCopy = clone_into(&persistent, sparse);
+    assert(sparseCopy);
+    assert(persistent.stats.allocations[JSON_ALLOC_BULK] == 1);
+    #if defined(JSON_INLINE_STRINGS) && !defined(JSON_COMPACT_VALUES)
+    // Short strings are copied along with their value.
+    assert(persistent.stats.allocations[JSON_ALLOC_STRING] == 0);
+    #else
+    assert(persistent.stats.allocations[JSON_ALLOC_STRING] == 1);
+    #endif
+
+    // The copies survive the scratch pool being reset and overwritten.
+    Json_reset_mempool();
+    memset(scratch->start, 0xAB, scratch->end - scratch->start);
+
+    Json_use_mempool(&persistent);
+    dump_JsonObject(payload, buffer);
+    printf("%s\n", buffer);
+    assert(strcmp(buffer, "{\"name\":\"abc\",\"list\":[1,\"two\",{\"x\":null}]}") == 0);
+    dump_JsonObject(sparseCopy, buffer);
+    printf("%s\n", buffer);
+    assert(strcmp(buffer, "{\"s\":\"str\",\"o\":{}}") == 0);
+
+    // Copies can be modified like any other object.
+    set_value_bool(payload, "name", true);
+    assert(get_value(payload, "name").data.b);
+
+    Json_use_mempool(scratch);
+}
+
+void test_patch()
+{
+    printf("\nTESTING PATCH\n");
+    char patch[512];
+    char dumped[256];
+    char expected[256];
+    JsonObject *a, *b;
+    assert(parse_JsonObject("{\"name\": \"abc\", \"a/b\": 1, \"list\": [1, 2, 3], \"inner\": {\"x\": true, \"y\": null}}", &a));
+    assert(parse_JsonObject("{\"name\": \"abd\", \"list\": [1, 5], \"inner\": {\"x\": true, \"z\": 2}, \"names\": []}", &b));
+
+    diff_JsonObject(a, b, patch);
+    printf("%s\n", patch);
+    assert(strstr(patch, "{\"op\":\"remove\",\"path\":\"/a~1b\"}"));
+    assert(strstr(patch, "{\"op\":\"replace\",\"path\":\"/list/1\",\"value\":5}"));
+    assert(strstr(patch, "{\"op\":\"remove\",\"path\":\"/list/2\"}"));
+    assert(strstr(patch, "{\"op\":\"add\",\"path\":\"/inner/z\",\"value\":2}"));
+    assert(!strstr(patch, "/inner/x"));
+
+    // Applying the diff turns one object into the other.
+    assert(apply_JsonPatch(a, patch));
+    dump_JsonObject(a, dumped);
+    dump_JsonObject(b, expected);
+    assert(strcmp(dumped, expected) == 0);
+    diff_JsonObject(a, b, patch);
+    assert(strcmp(patch, "[]") == 0);
+
+    assert(apply_JsonPatch(a, "[{\"op\": \"copy\", \"from\": \"/inner\", \"path\": \"/copy\"},"
+                              " {\"op\": \"move\", \"from\": \"/list/0\", \"path\": \"/names/-\"},"
+                              " {\"path\": \"/copy/z\", \"op\": \"replace\", \"value\": [\"deep\", {}]},"
+                              " {\"op\": \"test\", \"path\": \"/inner\", \"value\": {\"z\": 2, \"x\": true}}]"));
+    dump_JsonObject(a, dumped);
+    printf("%s\n", dumped);
+    assert(get_value(a, "list").data.a->length == 1);
+    assert(get_value(a, "names").data.a->length == 1);
+    assert(get_value(get_value(a, "inner").data.o, "z").type == JSON_INT);
+    assert(get_value(get_value(a, "copy").data.o, "z").type == JSON_ARRAY);
+
+    assert(!apply_JsonPatch(a, "[{\"op\": \"test\", \"path\": \"/name\", \"value\": \"abc\"}]"));
+    assert(!apply_JsonPatch(a, "[{\"op\": \"remove\", \"path\": \"/missing/key\"}]"));
+    assert(!apply_JsonPatch(a, "[{\"op\": \"move\", \"from\": \"/inner\", \"path\": \"/inner/x\"}]"));
+
+    // Only objects and arrays can have something added to them, and a move
+    // that cannot add leaves its source where it was.
+    JsonObject * scalars;
+    assert(parse_JsonObject("{\"x\": null, \"n\": 1, \"s\": \"str\", \"list\": [1, 2]}", &scalars));
+    assert(!apply_JsonPatch(scalars, "[{\"op\": \"add\", \"path\": \"/x/k\", \"value\": 1}]"));
+    assert(!apply_JsonPatch(scalars, "[{\"op\": \"add\", \"path\": \"/n/0\", \"value\": 1}]"));
+    assert(!apply_JsonPatch(scalars, "[{\"op\": \"add\", \"path\": \"/s/-\", \"value\": 1}]"));
+    assert(!apply_JsonPatch(scalars, "[{\"op\": \"move\", \"from\": \"/n\", \"path\": \"/x/k\"}]"));
+    assert(!apply_JsonPatch(scalars, "[{\"op\": \"move\", \"from\": \"/n\", \"path\": \"/missing/k\"}]"));
+    assert(!apply_JsonPatch(scalars, "[{\"op\": \"move\", \"from\": \"/list/0\", \"path\": \"/list/2\"}]"));
+    dump_JsonObject(scalars, dumped);
+    printf("%s\n", dumped);
+    assert(strcmp(dumped, "{\"x\":null,\"n\":1,\"s\":\"str\",\"list\":[1,2]}") == 0);
+
+    // Keys too long for the path buffer make the diff fail instead of leaving them out.
+    char key[JSON_KEY_LENGTH + 1];
+    memset(key, 'k', JSON_KEY_LENGTH);
+    key[JSON_KEY_LENGTH - 1] = '\0';
+    Json_reset_mempool();
+    a = create_JsonObject();
+    b = create_JsonObject();
+    set_value_int(b, key, 1);
+    assert(diff_JsonObject(a, b, patch) > 2);
+    key[JSON_KEY_LENGTH - 1] = 'k';
+    key[JSON_KEY_LENGTH] = '\0';
+    Json_reset_mempool();
+    a = create_JsonObject();
+    b = create_JsonObject();
+    set_value_int(b, key, 1);
+    assert(diff_JsonObject(a, b, patch) == 0 && patch[0] == '\0');
+    assert(diff_JsonObject(b, a, patch) == 0);
+}
+
+void test_merge_patch()
+{
+    printf("\nTESTING MERGE PATCH\n");
+    char dumped[256];
+    JsonObject *target, *patch, *empty;
+    assert(parse_JsonObject("{\"a\": \"b\", \"ab\": 1, \"c\": {\"d\": \"e\", \"f\": \"g\"}, \"h\": [1]}", &target));
+    assert(parse_JsonObject("{\"a\": \"z\", \"ab\": null, \"c\": {\"f\": null, \"i\": true}, \"h\": {\"j\": null, \"k\": 2}, \"\": 3}", &patch));
+
+    assert(merge_patch(target, patch));
+    dump_JsonObject(target, dumped);
+    printf("%s\n", dumped);
+    assert(strcmp(get_value_string(target, "a"), "z") == 0);
+    assert(get_value(target, "ab").type == JSON_ERROR);
+    assert(get_value(target, "").data.i == 3);
+
+    JsonObject * c = get_value(target, "c").data.o;
+    assert(strcmp(get_value_string(c, "d"), "e") == 0);
+    assert(get_value(c, "f").type == JSON_ERROR);
+    assert(get_value(c, "i").data.b);
+
+    // Objects that replace something else have their nulls dropped, and are not
+    // shared with the patch.
+    JsonObject * h = get_value(target, "h").data.o;
+    assert(h != get_value(patch, "h").data.o);
+    assert(get_value(h, "j").type == JSON_ERROR);
+    assert(get_value(h, "k").data.i == 2);
+
+    empty = create_JsonObject();
+    assert(merge_patch(empty, patch));
+    assert(get_value(empty, "a").type == JSON_STRING);
+    assert(get_value(empty, "ab").type == JSON_ERROR);
+}
+
+void test_hash_equal()
+{
+    printf("\nTESTING HASH AND EQUALITY\n");
+    JsonObject *a, *b, *c;
+    assert(parse_JsonObject("{\"ab\": 1, \"a\": [true, \"x\"], \"n\": {\"k\": null, \"\": -0}}", &a));
+    assert(parse_JsonObject("{\"n\": {\"\": 0, \"k\": null}, \"a\": [true, \"x\"], \"ab\": 1}", &b));
+    assert(parse_JsonObject("{\"ab\": 1, \"a\": [\"x\", true], \"n\": {\"k\": null, \"\": 0}}", &c));
+
+    // Insertion order does not matter, but array order does.
+    JsonMempoolStats before, after;
+    Json_get_mempool_stats(&before);
+    assert(json_equal(a, b));
+    assert(json_hash(a, 0) == json_hash(b, 0));
+    assert(!json_equal(a, c));
+    assert(json_hash(a, 0) != json_hash(c, 0));
+    assert(json_hash(a, 0) != json_hash(a, 1));
+    Json_get_mempool_stats(&after);
+    assert(before.used == after.used);
+
+    // Keys that were removed leave nodes behind, which are not members.
+    set_value_bool(b, "abc", true);
+    assert(!json_equal(a, b));
+    remove_value(b, "abc");
+    assert(json_equal(a, b));
+    assert(json_equal(b, a));
+    assert(json_hash(a, 7) == json_hash(b, 7));
+
+    // Integers and doubles are equal only when the double holds the integer exactly.
+    a = create_JsonObject();
+    b = create_JsonObject();
+    set_value_int(a, "n", 9007199254740992);
+    set_value_double(b, "n", 9007199254740992.0);
+    assert(json_equal(a, b));
+    assert(json_hash(a, 0) == json_hash(b, 0));
+    set_value_int(a, "n", 9007199254740993);
+    assert(!json_equal(a, b));
+    set_value_int(a, "n", 1);
+    set_value_double(b, "n", 1.5);
+    assert(!json_equal(a, b));
+    set_value_double(b, "n", 1e300);
+    assert(!json_equal(a, b));
+    set_value_float(b, "n", 1);
+    assert(json_equal(a, b));
+}
+
+void test_freeze()
+{
+    printf("\nTESTING FREEZE\n");
+    char buffer[256];
+    char frozenMemory[1024];
+    JsonMempool frozenPool;
+    Json_init_mempool(&frozenPool, frozenMemory, sizeof(frozenMemory));
+    JsonMempool* scratch = Json_get_mempool();
+
+    // Built out of order, so siblings and strings are spread across the pool.
+    JsonObject* o = create_JsonObject();
+    set_value_string(o, "beta", "two");
+    JsonObject* inner = create_JsonObject();
+    set_value_float(inner, "x", 1);
+    set_value_object(o, "inner", inner);
+    set_value_string(o, "alpha", "one");
+    JsonArray* list = create_JsonArray(2);
+    set_element_string(list, 0, "a");
+    set_element_object(list, 1, create_JsonObject());
+    set_value_array(o, "list", list);
+    set_value_null(inner, "y");
+    dump_JsonObject(o, buffer);
+
+    JsonObject* frozen = freeze(&frozenPool, o);
+    assert(frozen);
+    assert(frozenPool.stats.allocations[JSON_ALLOC_BULK] == 1);
+
+    Json_use_mempool(&frozenPool);
+    char frozenBuffer[256];
+    dump_JsonObject(frozen, frozenBuffer);
+    printf("%s\n", frozenBuffer);
+    assert(strcmp(buffer, frozenBuffer) == 0);
+
+    // The root's siblings follow it directly.
+    JsonNode* root = &(frozen->node);
+    u_int16_t rootOffset = (u_int8_t *) root - frozenPool.start;
+    assert(root->sibling == rootOffset + sizeof(JsonNode));
+    assert(strcmp(get_value_string(frozen, "alpha"), "one") == 0);
+    assert(get_value(get_value(frozen, "inner").data.o, "y").type == JSON_NULL);
+
+    Json_use_mempool(scratch);
+}
+
+void test_parse_errors()
+{
+    printf("\nTESTING PARSE ERRORS\n");
+    JsonObject* parsed;
+    JsonParseError error;
+
+    char* missingColon = "{\"a\" 1}";
+    assert(!parse_JsonObject_with_error(missingColon, &parsed, &error));
+    print_JsonParseError(missingColon, &error);
+    assert(error.code == JSON_PARSE_UNEXPECTED_TOKEN);
+    assert(error.offset == 5 && error.line == 1 && error.column == 6);
+    assert(strcmp(error.expected, "':'") == 0);
+    assert(!parsed);
+
+    assert(!parse_JsonObject_with_error("{\n  \"a\": tru}", &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_TOKEN && error.line == 2 && error.column == 11);
+
+    assert(!parse_JsonObject_with_error("{\"a\": \"abc", &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_END);
+
+    // Strings are scanned eight bytes at a time, but never past the terminator,
+    // even when the input ends inside a string.
+    char* unterminated = "{\"a\": \"abcdefghijklmnopqrstuvwxyz0123456789";
+    char* exact = malloc(strlen(unterminated) + 1);
+    strcpy(exact, unterminated);
+    assert(!parse_JsonObject_with_error(exact, &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_END);
+    free(exact);
+    assert(!parse_JsonObject_with_error("{\"a\": \"\\q\"}", &parsed, &error));
+    assert(error.code == JSON_PARSE_INVALID_ESCAPE);
+    assert(!parse_JsonObject_with_error("{\"a\": -}", &parsed, &error));
+    assert(error.code == JSON_PARSE_INVALID_NUMBER && error.offset == 6);
+
+    // Only whitespace may follow the object.
+    assert(!parse_JsonObject_with_error("{} x", &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_TOKEN && strcmp(error.expected, "end of input") == 0);
+    assert(!parse_JsonObject_with_error("{\"a\": 1}\n{\"b\": 2}", &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_TOKEN && error.line == 2 && error.column == 1);
+    assert(!parse_JsonObject("{}{}", &parsed) && !parsed);
+    assert(parse_JsonObject("{} \t\r\n", &parsed));
+
+    // The parser's fixed size stacks and buffers are reported, not overrun.
+    char input[2100];
+    char* c = input + sprintf(input, "{\"a\": ");
+    for (int i = 0; i < 200; i++) *(c++) = '[';
+    *c = '\0';
+    assert(!parse_JsonObject_with_error(input, &parsed, &error));
+    assert(error.code == JSON_PARSE_LIMIT_EXCEEDED);
+
+    c = input + sprintf(input, "{\"a\": \"");
+    for (int i = 0; i < 2000; i++) *(c++) = 'x';
+    sprintf(c, "\"}");
+    assert(!parse_JsonObject_with_error(input, &parsed, &error));
+    assert(error.code == JSON_PARSE_LIMIT_EXCEEDED);
+
+    char smallMemory[64];
+    JsonMempool small;
+    Json_init_mempool(&small, smallMemory, sizeof(smallMemory));
+    JsonMempool* previous = Json_get_mempool();
+    Json_use_mempool(&small);
+    assert(!parse_JsonObject_with_error("{\"abcdefghijklmnop\": 1}", &parsed, &error));
+    assert(error.code == JSON_PARSE_OUT_OF_MEMORY);
+    Json_use_mempool(previous);
+
+    assert(parse_JsonObject_with_error(" {\"a\": [1, \"b\"]} \n", &parsed, &error));
+    assert(error.code == JSON_PARSE_OK);
+}
+
+void test_validate()
+{
+    printf("\nTESTING VALIDATE\n");
+    char* valid[] = {
+        "{}",
+        " { \"a\" : [ ] , \"b\":{}}\n",
+        "{\"a\": [1, -0.5, 2e10, 3E-2, 0, true, false, null, \"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00eF\"]}",
+        "{\"a long string that goes past eight bytes\": {\"nested\": [[[{\"x\": \"y\"}]]]}}",
+    };
+    char* invalid[] = {
+        "",
+        "[1, 2]",
+        "{\"a\": 1,}",
+        "{\"a\": [1,]}",
+        "{\"a\": 01}",
+        "{\"a\": 1.}",
+        "{\"a\": .5}",
+        "{\"a\": -}",
+        "{\"a\": 1e}",
+        "{\"a\": tru}",
+        "{\"a\": \"\\x\"}",
+        "{\"a\": \"\\u12g4\"}",
+        "{\"a\": \"tab\there\"}",
+        "{\"a\": [}",
+        "{\"a\" 1}",
+        "{a: 1}",
+        "{} {}",
+        "{\"a\": \"unterminated string",
+        "{\"a\": 0x1}",
+        "{\"a\": -01}",
+        "{\"a\": 00.5}",
+        "{\"a\": +1}",
+        "{\"a\": -inf}",
+        "{\"a\":\v1}",
+    };
+
+    JsonMempoolStats before, after;
+    Json_get_mempool_stats(&before);
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+    {
+        assert(validate_Json(valid[i], strlen(valid[i])));
+    }
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        assert(!validate_Json(invalid[i], strlen(invalid[i])));
+    }
+    Json_get_mempool_stats(&after);
+    assert(before.used == after.used);
+
+    // The parser accepts the same grammar.
+    JsonObject* parsed;
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+    {
+        assert(parse_JsonObject(valid[i], &parsed));
+    }
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        assert(!parse_JsonObject(invalid[i], &parsed));
+    }
+
+    // Only the given length is read.
+    char* prefix = "{\"a\": 1}garbage";
+    assert(validate_Json(prefix, 8));
+    assert(!validate_Json(prefix, 7));
+
+    char deep[3000];
+    char* c = deep + sprintf(deep, "{\"a\": ");
+    for (int i = 0; i < 1100; i++) *(c++) = '[';
+    for (int i = 0; i < 1100; i++) *(c++) = ']';
+    *(c++) = '}';
+    assert(!validate_Json(deep, c - deep));
+}
+
+void test_projection()
+{
+    printf("\nTESTING PROJECTION\n");
+    char buffer[256];
+    char* input = "{\"a\": [1, 2, {\"q\": 1}], \"b\": {\"k\": [1, {\"m\": 2}]}, \"c\": \"skipped\","
+                  " \"d\": {\"x\": 1, \"xy\": {\"z\": 2}, \"y\": {\"x\": 3}}, \"e/f\": [{\"x\": 1}], \"g\": null}";
+    JsonObject* parsed;
+    JsonMempoolStats stats;
+
+    assert(parse_JsonObject(input, &parsed));
+    Json_get_mempool_stats(&stats);
+    size_t fullUsed = stats.last_parse_used;
+
+    Json_reset_mempool();
+    char* paths[] = { "/b", "/d/x", "/e~1f", "/missing/key" };
+    assert(parse_JsonObject_projected(input, paths, 4, &parsed));
+    dump_JsonObject(parsed, buffer);
+    printf("%s\n", buffer);
+    assert(strcmp(buffer, "{\"b\":{\"k\":[1,{\"m\":2}]},\"d\":{\"x\":1},\"e/f\":[{\"x\":1}]}") == 0);
+    Json_get_mempool_stats(&stats);
+    assert(stats.last_parse_used < fullUsed);
+
+    // The empty path keeps everything, and no paths keep nothing.
+    Json_reset_mempool();
+    char* everything[] = { "" };
+    assert(parse_JsonObject_projected(input, everything, 1, &parsed));
+    assert(get_value(parsed, "g").type == JSON_NULL);
+    assert(parse_JsonObject_projected(input, NULL, 0, &parsed));
+    dump_JsonObject(parsed, buffer);
+    assert(strcmp(buffer, "{}") == 0);
+
+    // Paths must be valid pointers, so every '~' is an escape.
+    char* invalid[][2] = { { "/b", "/a~" }, { "/e~2f", "/b" }, { "/b~/k", "/d" }, { "b", "/d" } };
+    for (int i = 0; i < 4; i++)
+    {
+        assert(!parse_JsonObject_projected(input, invalid[i], 2, &parsed));
+        assert(parsed == NULL);
+    }
+}
+
+typedef struct EventLog
+{
+    char * c;
+    int count;
+    int stopAfter;
+} EventLog;
+
+bool log_event(EventLog* log, char* format, char* str, size_t length)
+{
+    log->c += sprintf(log->c, format, (int) length, str);
+    return ++(log->count) != log->stopAfter;
+}
+
+bool on_object_start(void* log) { return log_event(log, "{%.*s", "", 0); }
+bool on_object_end(void* log) { return log_event(log, "}%.*s", "", 0); }
+bool on_array_start(void* log) { return log_event(log, "[%.*s", "", 0); }
+bool on_array_end(void* log) { return log_event(log, "]%.*s", "", 0); }
+bool on_key(void* log, char* key, size_t length) { return log_event(log, "k:%.*s ", key, length); }
+bool on_string(void* log, char* str, size_t length) { return log_event(log, "s:%.*s ", str, length); }
+bool on_number(void* log, double value) { return log_event(log, value > 0 ? "n+%.*s " : "n-%.*s ", "", 0); }
+bool on_bool(void* log, bool value) { return log_event(log, value ? "true%.*s " : "false%.*s ", "", 0); }
+bool on_null(void* log) { return log_event(log, "null%.*s ", "", 0); }
+
+bool count_string(void* count, char* str, size_t length)
+{
+    (void) str;
+    (void) length;
+    (*(int*) count)++;
+    return true;
+}
+
+void test_events()
+{
+    printf("\nTESTING EVENTS\n");
+    char events[256];
+    EventLog log = { .c = events, .count = 0, .stopAfter = -1 };
+    JsonHandler handler = {
+        &log, on_object_start, on_object_end, on_array_start, on_array_end,
+        on_key, on_string, on_number, on_bool, on_null, NULL
+    };
+    JsonParseError error;
+
+    JsonMempoolStats before, after;
+    Json_get_mempool_stats(&before);
+    assert(parse_JsonEvents("{\"a\": [1, \"x\", {\"b\": null}], \"c\": {\"d\": -2, \"e\": true}, \"f\": []}", &handler, &error));
+    Json_get_mempool_stats(&after);
+    printf("%s\n", events);
+    assert(strcmp(events, "{k:a [n+ s:x {k:b null }]k:c {k:d n- k:e true }k:f []}") == 0);
+    assert(before.used == after.used);
+
+    // Handlers can stop parsing early.
+    log = (EventLog) { .c = events, .count = 0, .stopAfter = 3 };
+    assert(!parse_JsonEvents("{\"a\": 1, \"b\": 2}", &handler, &error));
+    assert(error.code == JSON_PARSE_STOPPED);
+    assert(log.count == 3);
+
+    // Events need no buffers to hold the document, so arrays can be any length.
+    static char large[32768];
+    char* c = large + sprintf(large, "{\"list\": [");
+    for (int i = 0; i < 3000; i++) c += sprintf(c, i ? ", \"%d\"" : "\"%d\"", i);
+    sprintf(c, "]}");
+    int strings = 0;
+    JsonHandler counter = { .context = &strings, .on_string = count_string };
+    assert(parse_JsonEvents(large, &counter, &error));
+    assert(strings == 3000);
+
+    // Strings, though, have to fit in the string buffer.
+    c = large + sprintf(large, "{\"s\": \"");
+    memset(c, 'x', JSON_STRING_BUFFER_LENGTH / 2);
+    sprintf(c + JSON_STRING_BUFFER_LENGTH / 2, "\"}");
+    assert(parse_JsonEvents(large, &counter, &error));
+    memset(c, 'x', JSON_STRING_BUFFER_LENGTH);
+    sprintf(c + JSON_STRING_BUFFER_LENGTH, "\"}");
+    assert(!parse_JsonEvents(large, &counter, &error));
+    assert(error.code == JSON_PARSE_LIMIT_EXCEEDED);
+}
+
+void test_unicode()
+{
+    printf("\nTESTING UNICODE\n");
+    JsonObject * parsed;
+    char* input = "{\"e\": \"caf\\u00e9\", \"smile\": \"\\ud83d\\ude00\", \"raw\": \"na\xc3\xafve \xe2\x82\xac \xf0\x9f\x98\x80\", "
+        "\"\xc3\xa9t\xc3\xa9\": 1, \"long\": \"eight bytes at a time, then \xc3\xa9 and \\u20AC at the end\"}";
+    assert(parse_JsonObject(input, &parsed));
+    assert(!strcmp(get_value_string(parsed, "e"), "caf\xc3\xa9"));
+    assert(!strcmp(get_value_string(parsed, "smile"), "\xf0\x9f\x98\x80"));
+    assert(!strcmp(get_value_string(parsed, "raw"), "na\xc3\xafve \xe2\x82\xac \xf0\x9f\x98\x80"));
+    assert(!strcmp(get_value_string(parsed, "long"), "eight bytes at a time, then \xc3\xa9 and \xe2\x82\xac at the end"));
+    assert(get_value(parsed, "\xc3\xa9t\xc3\xa9").type == JSON_INT);
+    assert(validate_Json(input, strlen(input)));
+
+    char buffer[8];
+    char* c = "\"\\u00e9\\ud83d\\ude00\"";
+    assert(scan_JsonString(&c, buffer, sizeof(buffer)) && !strcmp(buffer, "\xc3\xa9\xf0\x9f\x98\x80"));
+    c = "\"\\ud83d\\ude00\\ud83d\\ude00\"";
+    assert(!scan_JsonString(&c, buffer, sizeof(buffer)));
+
+    struct { char* input; JsonParseErrorCode code; } invalid[] = {
+        { "{\"a\": \"\\ud83d\"}", JSON_PARSE_INVALID_ESCAPE },
+        { "{\"a\": \"\\ude00\"}", JSON_PARSE_INVALID_ESCAPE },
+        { "{\"a\": \"\\ud83d\\u0041\"}", JSON_PARSE_INVALID_ESCAPE },
+        { "{\"a\": \"\\u00\"}", JSON_PARSE_INVALID_ESCAPE },
+        { "{\"a\": \"\xff\"}", JSON_PARSE_INVALID_UTF8 },
+        { "{\"a\": \"\xc3\"}", JSON_PARSE_INVALID_UTF8 },
+        { "{\"a\": \"\xc0\xaf\"}", JSON_PARSE_INVALID_UTF8 },
+        { "{\"a\": \"\xe0\x80\xaf\"}", JSON_PARSE_INVALID_UTF8 },
+        { "{\"a\": \"\xed\xa0\x80\"}", JSON_PARSE_INVALID_UTF8 },
+        { "{\"a\": \"\xf4\x90\x80\x80\"}", JSON_PARSE_INVALID_UTF8 },
+        { "{\"a\": \"long enough for a chunk \xe2\x82\"}", JSON_PARSE_INVALID_UTF8 },
+        { "{\"a\": \"tab\there\"}", JSON_PARSE_UNEXPECTED_TOKEN },
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        JsonParseError error;
+        Json_reset_mempool();
+        assert(!parse_JsonObject_with_error(invalid[i].input, &parsed, &error));
+        assert(error.code == invalid[i].code);
+        assert(!validate_Json(invalid[i].input, strlen(invalid[i].input)));
+    }
+
+    // \u0000 is valid JSON, which the parser only rejects because strings are terminated.
+    assert(validate_Json("{\"a\": \"\\u0000\"}", 15));
+    assert(!parse_JsonObject("{\"a\": \"\\u0000\"}", &parsed));
+
+    // A truncated sequence at the end of the given length is rejected.
+    assert(!validate_Json("{\"a\": \"\xc3\xa9\"}", 8));
+}
+
+void test_escaping()
+{
+    printf("\nTESTING ESCAPING\n");
+    char output[512];
+    assert(dump_JsonString("plain", output) == 7 && !strcmp(output, "\"plain\""));
+    size_t length = dump_JsonString("a \"quoted\" \\ path\n\ttab \x01 and \xc3\xa9", output);
+    output[length] = '\0';
+    assert(!strcmp(output, "\"a \\\"quoted\\\" \\\\ path\\n\\ttab \\u0001 and \xc3\xa9\""));
+
+    JsonObject * o = create_JsonObject();
+    set_value_string(o, "say \"hi\"", "line one\nline two \"with quotes\" and a \\ backslash");
+    set_value_string(o, "bell\x07", "\x1f\r\b\f");
+    set_value_string(o, "plain", "nothing to escape in this longer string");
+    length = dump_JsonObject(o, output);
+    printf("%s\n", output);
+    assert(length == strlen(output));
+    assert(validate_Json(output, length));
+
+    // Escaped output parses back to the same object.
+    JsonObject * parsed;
+    assert(parse_JsonObject(output, &parsed));
+    assert(json_equal(o, parsed));
+    assert(!strcmp(get_value_string(parsed, "bell\x07"), "\x1f\r\b\f"));
+
+    // Paths in a diff are escaped too. Only objects validate, so wrap the patch in one.
+    JsonObject * empty = create_JsonObject();
+    diff_JsonObject(empty, o, output);
+    char wrapped[600];
+    sprintf(wrapped, "{\"patch\": %s}", output);
+    assert(validate_Json(wrapped, strlen(wrapped)));
+    assert(apply_JsonPatch(empty, output));
+    assert(json_equal(empty, o));
+}
+
+bool sum_integer(void* sum, int64_t value)
+{
+    *(int64_t*) sum += value;
+    return true;
+}
+
+void test_numbers()
+{
+    printf("\nTESTING NUMBERS\n");
+    JsonObject * parsed;
+    char* input = "{\"id\": 9007199254740993, \"min\": -9223372036854775808, \"max\": 9223372036854775807, "
+        "\"over\": 9223372036854775808, \"half\": 0.5, \"exp\": 1e3, \"zero\": -0, \"third\": 0.3333333333333333}";
+    assert(parse_JsonObject(input, &parsed));
+    assert(get_value(parsed, "id").type == JSON_INT && get_value(parsed, "id").data.i == 9007199254740993LL);
+    assert(get_value(parsed, "min").data.i == INT64_MIN);
+    assert(get_value(parsed, "max").data.i == INT64_MAX);
+    assert(get_value(parsed, "over").type == JSON_DOUBLE);
+    assert(get_value(parsed, "half").type == JSON_DOUBLE && get_value(parsed, "half").data.d == 0.5);
+    assert(get_value(parsed, "exp").type == JSON_DOUBLE);
+    assert(get_value(parsed, "zero").type == JSON_INT);
+
+    // Whole numbers read back as integers whatever their type.
+    int64_t i;
+    double d;
+    assert(get_int(get_value(parsed, "exp"), &i) && i == 1000);
+    assert(!get_int(get_value(parsed, "half"), &i));
+    assert(!get_int(get_value(parsed, "over"), &i));
+    assert(get_double(get_value(parsed, "id"), &d) && d == 9007199254740992.0);
+    assert(!get_double(get_value(parsed, "missing"), &d));
+
+    char output[512];
+    size_t length = dump_JsonObject(parsed, output);
+    printf("%s\n", output);
+    assert(strstr(output, "\"id\":9007199254740993"));
+    assert(strstr(output, "\"min\":-9223372036854775808"));
+    assert(strstr(output, "\"third\":0.3333333333333333}"));
+    JsonObject * reparsed;
+    assert(parse_JsonObject(output, &reparsed));
+    assert(json_equal(parsed, reparsed));
+    assert(validate_Json(output, length));
+
+    int64_t ints[] = { 0, 7, 10, 99, 100, 12345, -1, -100, INT64_MIN };
+    char* intText[] = { "0", "7", "10", "99", "100", "12345", "-1", "-100", "-9223372036854775808" };
+    for (size_t n = 0; n < sizeof(ints) / sizeof(ints[0]); n++)
+    {
+        length = dump_JsonInt(ints[n], output);
+        output[length] = '\0';
+        assert(!strcmp(output, intText[n]));
+    }
+    length = dump_JsonDouble(0.1, output);
+    assert(length == 3 && !strncmp(output, "0.1", 3));
+    length = dump_JsonDouble(0.1 + 0.2, output);
+    output[length] = '\0';
+    assert(strtod(output, NULL) == 0.1 + 0.2);
+    assert(dump_JsonDouble(1.0 / 0.0, output) == 4 && !strncmp(output, "null", 4));
+
+    // Equal numbers are equal across types, and hash the same.
+    JsonObject * a = create_JsonObject();
+    JsonObject * b = create_JsonObject();
+    set_value_int(a, "n", 2);
+    set_value_double(b, "n", 2.0);
+    assert(json_equal(a, b));
+    assert(json_hash(a, 1) == json_hash(b, 1));
+    set_value_float(b, "n", 2.5f);
+    assert(!json_equal(a, b));
+
+    JsonArray * array = create_JsonArray(2);
+    set_element_int(array, 0, -5);
+    set_element_double(array, 1, 2.25);
+    assert(get_element(array, 0).data.i == -5 && get_element(array, 1).data.d == 2.25);
+
+    // Integers go to on_integer when it is set.
+    int64_t sum = 0;
+    JsonHandler handler = { .context = &sum, .on_integer = sum_integer };
+    assert(parse_JsonEvents("{\"a\": [1, 2, 3], \"b\": 4000000000, \"c\": 0.5}", &handler, NULL));
+    assert(sum == 4000000006LL);
+
+    char* c = "12.5";
+    assert(!scan_JsonInt(&c, &i) && c[0] == '1');
+    assert(scan_JsonDouble(&c, &d) && d == 12.5 && !*c);
+}
+
+// Freezes and clones obj into a mempool of its own, and switches to it so the
+// copies can be read. Returns the mempool that was in use before.
+JsonMempool* copy_into_other_mempool(JsonObject* obj, JsonObject** frozen, JsonObject** cloned)
+{
+    static char otherMemory[1024];
+    static JsonMempool other;
+    JsonMempool* previous = Json_get_mempool();
+    Json_init_mempool(&other, otherMemory, sizeof(otherMemory));
+    *frozen = freeze(&other, obj);
+    *cloned = clone_into(&other, obj);
+    assert(*frozen && *cloned);
+    Json_use_mempool(&other);
+    return previous;
+}
+
+void test_inline_strings()
+{
+    printf("\nTESTING INLINE STRINGS\n");
+    assert(sizeof(JsonValue) == 16);
+    JsonMempoolStats stats;
+    JsonObject* o = create_JsonObject();
+    set_value_string(o, "method", "GET");
+    set_value_string(o, "seven", "1234567");
+    set_value_string(o, "eight", "12345678");
+    set_value_string(o, "empty", "");
+    Json_get_mempool_stats(&stats);
+    #if defined(JSON_INLINE_STRINGS) && !defined(JSON_COMPACT_VALUES)
+    assert(stats.allocations[JSON_ALLOC_STRING] == 1);
+    assert(stats.bytes[JSON_ALLOC_STRING] == 9);
+    #else
+    // Without the flag, or in compact slots, which have no room for characters,
+    // every string is allocated and data.s is valid.
+    assert(stats.allocations[JSON_ALLOC_STRING] == 4);
+    assert(!strcmp(get_value(o, "method").data.s, "GET"));
+    #endif
+
+    // Copies of a value carry their inline string with them.
+    JsonValue value = get_value(o, "seven");
+    #if defined(JSON_INLINE_STRINGS) && !defined(JSON_COMPACT_VALUES)
+    assert(value.flags & JSON_VALUE_INLINE);
+    #endif
+    assert(!strcmp(get_string(&value), "1234567"));
+    value = get_value(o, "eight");
+    assert(!(value.flags & JSON_VALUE_INLINE) && get_string(&value) == value.data.s);
+    assert(!strcmp(get_value_string(o, "method"), "GET"));
+    assert(!strcmp(get_value_string(o, "empty"), ""));
+    assert(get_value_string(o, "missing") == NULL);
+    set_value_bool(o, "flag", true);
+    assert(get_value_string(o, "flag") == NULL);
+
+    JsonObject* parsed;
+    char* input = "{\"list\": [\"ok\", \"a longer string\", \"\\u00e9\"], \"status\": \"ok\", \"long\": \"12345678\"}";
+    Json_reset_mempool();
+    assert(parse_JsonObject(input, &parsed));
+    Json_get_mempool_stats(&stats);
+    #if defined(JSON_INLINE_STRINGS) && !defined(JSON_COMPACT_VALUES)
+    assert(stats.allocations[JSON_ALLOC_STRING] == 2);
+    #else
+    assert(stats.allocations[JSON_ALLOC_STRING] == 5);
+    #endif
+    JsonArray* list = get_value(parsed, "list").data.a;
+    assert(!strcmp(get_element_string(list, 0), "ok"));
+    assert(!strcmp(get_element_string(list, 1), "a longer string"));
+    assert(!strcmp(get_element_string(list, 2), "\xc3\xa9"));
+    assert(get_element_string(list, 3) == NULL);
+
+    char buffer[256];
+    dump_JsonObject(parsed, buffer);
+    printf("%s\n", buffer);
+    assert(!strcmp(buffer, "{\"list\":[\"ok\",\"a longer string\",\"\xc3\xa9\"],\"long\":\"12345678\",\"status\":\"ok\"}"));
+
+    // Clones and frozen copies keep inline strings inline.
+    JsonObject *frozen, *copy;
+    JsonMempool* scratch = copy_into_other_mempool(parsed, &frozen, &copy);
+    assert(json_equal(frozen, copy));
+    assert(!strcmp(get_value_string(frozen, "status"), "ok"));
+    assert(!strcmp(get_value_string(copy, "long"), "12345678"));
+    Json_use_mempool(scratch);
+}
+
+void test_compact_values()
+{
+    printf("\nTESTING COMPACT VALUES\n");
+    #ifdef JSON_COMPACT_VALUES
+    assert(sizeof(JsonSlot) == 8);
+    #else
+    assert(sizeof(JsonSlot) == sizeof(JsonValue));
+    #endif
+
+    // Either side of the 48 bits that fit in a compact slot.
+    int64_t ints[] = { -1, 140737488355327, -140737488355328, 140737488355328, INT64_MIN, INT64_MAX };
+    JsonArray* array = create_JsonArray(8);
+    for (int i = 0; i < 6; i++)
+    {
+        set_element_int(array, i, ints[i]);
+    }
+    set_element_double(array, 6, -0.5);
+    set_element_float(array, 7, 1.5);
+    JsonObject* o = create_JsonObject();
+    set_value_array(o, "values", array);
+    set_value_bool(o, "yes", true);
+    set_value_null(o, "none");
+    set_value_double(o, "nan", NAN);
+
+    for (int i = 0; i < 6; i++)
+    {
+        JsonValue value = get_element(array, i);
+        assert(value.type == JSON_INT && value.data.i == ints[i]);
+    }
+    assert(get_element(array, 6).data.d == -0.5 && get_element(array, 7).data.f == 1.5);
+    assert(get_value(o, "yes").data.b && get_value(o, "none").type == JSON_NULL);
+    assert(isnan(get_value(o, "nan").data.d));
+
+    char buffer[256];
+    dump_JsonObject(o, buffer);
+    printf("%s\n", buffer);
+    assert(strstr(buffer, "[-1,140737488355327,-140737488355328,140737488355328,"
+        "-9223372036854775808,9223372036854775807,-0.5,"));
+
+    // Boxed integers follow their slots into other mempools.
+    JsonObject *frozen, *copy;
+    JsonMempool* scratch = copy_into_other_mempool(o, &frozen, &copy);
+    assert(get_element(get_value(frozen, "values").data.a, 4).data.i == INT64_MIN);
+    assert(get_element(get_value(copy, "values").data.a, 5).data.i == INT64_MAX);
+    assert(json_hash(frozen, 1) == json_hash(copy, 1));
+    Json_use_mempool(scratch);
+}
+
+void test_shapes()
+{
+    printf("\nTESTING SHAPES\n");
+    char* records = "{\"rows\": [{\"id\": 1, \"name\": \"ab\"}, {\"id\": 2, \"name\": \"cd\"}, "
+        "{\"id\": 3, \"name\": \"ef\"}, {\"id\": 4, \"name\": \"gh\"}]}";
+    char* expected = "{\"rows\":[{\"id\":1,\"name\":\"ab\"},{\"id\":2,\"name\":\"cd\"},"
+        "{\"id\":3,\"name\":\"ef\"},{\"id\":4,\"name\":\"gh\"}]}";
+    JsonObject* parsed;
+    assert(parse_JsonObject(records, &parsed));
+
+    // The objects in the array share one key trie. Tries of their own would take 37 nodes.
+    JsonMempoolStats stats;
+    Json_get_mempool_stats(&stats);
+    assert(stats.allocations[JSON_ALLOC_NODE] < 20);
+
+    char buffer[512];
+    dump_JsonObject(parsed, buffer);
+    printf("%s\n", buffer);
+    assert(strcmp(buffer, expected) == 0);
+
+    JsonArray* rows = get_value(parsed, "rows").data.a;
+    JsonObject* second = get_element(rows, 1).data.o;
+    JsonObject* last = get_element(rows, 3).data.o;
+    assert(get_value(second, "id").type == JSON_INT && get_value(second, "id").data.i == 2);
+    assert(strcmp(get_value_string(second, "name"), "cd") == 0);
+    assert(strcmp(get_value_string(last, "name"), "gh") == 0);
+    assert(get_value(second, "missing").type == JSON_ERROR);
+
+    char keyBuffer[JSON_KEY_LENGTH];
+    JsonObjectIterator it;
+    char* key;
+    size_t length;
+    JsonValue* value;
+    int count = 0;
+    obj_iter_begin(&it, second, keyBuffer, sizeof(keyBuffer));
+    while (obj_iter_next(&it, &key, &length, &value)) count++;
+    assert(count == 2);
+
+    // Structural comparisons see through shapes.
+    JsonObject* copy;
+    assert(parse_JsonObject(expected, &copy));
+    assert(json_equal(parsed, copy));
+    assert(json_hash(parsed, 7) == json_hash(copy, 7));
+    diff_JsonObject(parsed, copy, buffer);
+    assert(strcmp(buffer, "[]") == 0);
+
+    JsonObject *frozen, *cloned;
+    JsonMempool* scratch = copy_into_other_mempool(parsed, &frozen, &cloned);
+    assert(json_equal(frozen, cloned));
+    assert(strcmp(get_value_string(get_element(get_value(cloned, "rows").data.a, 2).data.o, "name"), "ef") == 0);
+    Json_use_mempool(scratch);
+
+    // Changing the keys of one object gives it a trie of its own.
+    assert(set_value_bool(second, "extra", true));
+    assert(remove_value(last, "id"));
+    assert(set_value_float(get_element(rows, 0).data.o, "id", 10));
+    dump_JsonObject(parsed, buffer);
+    printf("%s\n", buffer);
+    assert(strcmp(buffer, "{\"rows\":[{\"id\":10,\"name\":\"ab\"},{\"id\":2,\"name\":\"cd\",\"extra\":true},"
+        "{\"id\":3,\"name\":\"ef\"},{\"name\":\"gh\"}]}") == 0);
+    assert(!json_equal(parsed, copy));
+
+    // Objects with other keys, or fewer of them, keep tries of their own.
+    char* mixed = "{\"x\":[{\"a\":1,\"b\":2},{\"a\":3},{\"a\":4,\"c\":5},{\"b\":6,\"a\":7},{\"a\":8,\"b\":9,\"c\":0}]}";
+    assert(parse_JsonObject(mixed, &parsed));
+    dump_JsonObject(parsed, buffer);
+    printf("%s\n", buffer);
+    assert(strcmp(buffer, mixed) == 0);
+
+    // An object that runs out of memory while getting a trie of its own stays
+    // shaped. Leave room for a few nodes, which is less than its keys take.
+    assert(parse_JsonObject(records, &parsed));
+    second = get_element(get_value(parsed, "rows").data.a, 1).data.o;
+    JsonMempoolMark marks[4];
+    int allocated = 0;
+    do
+    {
+        marks[allocated++ % 4] = Json_mempool_mark();
+    } while (create_JsonObject());
+    assert(allocated > 4 && Json_mempool_release(marks[allocated % 4]));
+    assert(!set_value_bool(second, "extra", true));
+    dump_JsonObject(parsed, buffer);
+    assert(strcmp(buffer, expected) == 0);
+}
+
+void test_columns()
+{
+    printf("\nTESTING COLUMNS\n");
+    JsonObject* parsed;
+    assert(parse_JsonObject("{\"rows\": [{\"id\": 1, \"name\": \"alpha\", \"score\": 0.5, \"ok\": true}, "
+        "{\"id\": 2, \"name\": \"a longer name\", \"score\": 3, \"ok\": false}, "
+        "{\"id\": 3, \"name\": null, \"score\": 1.5, \"ok\": true}, "
+        "{\"ok\": false, \"id\": 4.5, \"score\": \"high\"}, 7, "
+        "{\"id\": 6, \"name\": \"f\", \"score\": -2, \"ok\": true}]}", &parsed));
+    JsonArray* rows = get_value(parsed, "rows").data.a;
+
+    int64_t ids[6];
+    char* names[6];
+    double scores[6];
+    float floats[6];
+    bool oks[6];
+    u_int8_t idNulls = 0, nameNulls = 0xFF, scoreNulls = 0, okNulls = 0;
+    JsonColumn columns[] = {
+        { "id", JSON_INT, ids, &idNulls },
+        { "name", JSON_STRING, names, &nameNulls },
+        { "score", JSON_DOUBLE, scores, &scoreNulls },
+        { "score", JSON_FLOAT, floats, NULL },
+        { "ok", JSON_BOOL, oks, &okNulls },
+    };
+    assert(export_JsonColumns(rows, columns, 5));
+
+    // Rows 3 and 4 are an object with other keys and a number.
+    assert(ids[0] == 1 && ids[1] == 2 && ids[2] == 3 && ids[3] == 0 && ids[5] == 6);
+    assert(idNulls == 0x18);
+    assert(strcmp(names[0], "alpha") == 0 && strcmp(names[1], "a longer name") == 0 && strcmp(names[5], "f") == 0);
+    assert(names[2] == NULL && names[3] == NULL && (nameNulls & 0x3F) == 0x1C);  // Bits past the rows are left alone
+    assert(scores[0] == 0.5 && scores[1] == 3 && scores[5] == -2 && scoreNulls == 0x18);
+    assert(floats[2] == 1.5f && floats[3] == 0);
+    assert(oks[0] && !oks[1] && oks[2] && !oks[3] && !oks[4] && oks[5] && okNulls == 0x10);
+
+    // Columns match what get_value reads, one row at a time.
+    for (int i = 0; i < 6; i++)
+    {
+        JsonValue element = get_element(rows, i);
+        if (element.type != JSON_OBJECT) continue;
+        char* name = get_value_string(element.data.o, "name");
+        assert(name == names[i] || strcmp(name, names[i]) == 0);
+    }
+
+    JsonColumn unsupported = { "id", JSON_OBJECT, ids, NULL };
+    assert(!export_JsonColumns(rows, &unsupported, 1));
+}
+
+// Writes length bytes of contents to a new temporary file, whose path is left in path.
+void write_temp_file(char * path, char * contents, size_t length)
+{
+    strcpy(path, "/tmp/jsonfun_XXXXXX");
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    assert(write(fd, contents, length) == (ssize_t) length);
+    close(fd);
+}
+
+void test_files()
+{
+    printf("\nTESTING FILES\n");
+    char path[32];
+    JsonObject* parsed;
+    JsonParseError error;
+
+    char* input = "{\"name\": \"file\", \"sizes\": [1, 2, 3]}\n";
+    write_temp_file(path, input, strlen(input));
+    assert(parse_JsonFile(path, &parsed, &error));
+    assert(error.code == JSON_PARSE_OK);
+    assert(strcmp(get_value_string(parsed, "name"), "file") == 0);
+    unlink(path);
+
+    // Nothing but the mapping's zeroed tail follows a file that fills its pages.
+    size_t page = sysconf(_SC_PAGESIZE);
+    char* contents = malloc(page);
+    memset(contents, ' ', page);
+    memcpy(contents, input, strlen(input));
+    write_temp_file(path, contents, page);
+    assert(parse_JsonFile(path, &parsed, NULL));
+    assert(get_element(get_value(parsed, "sizes").data.a, 2).data.i == 3);
+    unlink(path);
+    free(contents);
+
+    // The file has to end where the object does, even if a NUL comes first.
+    write_temp_file(path, "{} \0{}", 6);
+    assert(!parse_JsonFile(path, &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_TOKEN && error.offset == 3);
+    unlink(path);
+
+    write_temp_file(path, "{\"a\": \"x\0y\"}", 12);
+    assert(!parse_JsonFile(path, &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_TOKEN && error.offset == 8);
+    unlink(path);
+
+    write_temp_file(path, "{\"a\": 12\0}", 10);
+    assert(!parse_JsonFile(path, &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_TOKEN && error.offset == 8);
+    unlink(path);
+
+    write_temp_file(path, "", 0);
+    assert(!parse_JsonFile(path, &parsed, &error));
+    assert(error.code == JSON_PARSE_UNEXPECTED_END);
+    unlink(path);
+
+    assert(!parse_JsonFile(path, &parsed, &error));
+    assert(error.code == JSON_PARSE_IO_ERROR && parsed == NULL);
+}
+
+void test_parallel_dump()
+{
+    printf("\nTESTING PARALLEL DUMP\n");
+    char* inputs[] = {
+        "{}",
+        "{\"only\": 1}",
+        "{\"a\": 1, \"b\": [true, null], \"c\\n\": \"x\\\"y\", \"d\": {\"e\": 2.5}, \"\": -3}",
+        "{\"data\": {\"rows\": [{\"id\": 1, \"tag\": \"\\u0001\"}, {\"id\": 2, \"tag\": \"ok\"}, 3.25, \"s\", [], {}, "
+            "{\"id\": 1e300, \"tag\": null}]}}",
+        "{\"wrap\": {\"ab\": {\"xy\": 1}, \"abc\": 2, \"abd\": [0.1, 1.5e-7], \"b\": false}}",
+    };
+    char serial[1024];
+    char parallel[1024];
+    int threads[] = { 1, 2, 3, 7, 100 };
+    for (int i = 0; i < 5; i++)
+    {
+        JsonObject* parsed;
+        assert(parse_JsonObject(inputs[i], &parsed));
+        size_t length = dump_JsonObject(parsed, serial);
+        printf("%s\n", serial);
+        for (int j = 0; j < 5; j++)
+        {
+            memset(parallel, 'X', sizeof(parallel));
+            assert(dump_JsonObject_parallel(parsed, parallel, threads[j]) == length);
+            assert(strcmp(serial, parallel) == 0);
+        }
+    }
+
+    // Slices are cut by the bytes their members dump to, so they start from members
+    // at any depth of the trie, with prefixes shared with the slice before.
+    JsonObject* wide = create_JsonObject();
+    char member[16];
+    for (int i = 0; i < 60; i++)
+    {
+        sprintf(member, i % 3 ? "k%d" : "k%dx", i / 2);
+        if (i == 7)
+        {
+            set_value_string(wide, member, "a string long enough to be most of the bytes of the object, and then some more");
+        }
+        else
+        {
+            set_value_int(wide, member, i);
+        }
+    }
+    size_t wideLength = dump_JsonObject(wide, serial);
+    for (int j = 0; j < 5; j++)
+    {
+        memset(parallel, 'X', sizeof(parallel));
+        assert(dump_JsonObject_parallel(wide, parallel, threads[j]) == wideLength);
+        assert(strcmp(serial, parallel) == 0);
+    }
+
+    // Keys past JSON_KEY_LENGTH, both among the members split into slices and
+    // inside a slice's value
+    char key[301];
+    memset(key, 'k', 300);
+    key[300] = '\0';
+    char input[1024];
+    char* templates[] = {
+        "{\"rows\": {\"a\": 1, \"%s\": 2, \"b\": 3}}",
+        "{\"rows\": [{\"x\": {\"%s\": 1}}, {\"a\": 2}, {\"b\": 3}]}",
+    };
+    for (int i = 0; i < 2; i++)
+    {
+        JsonObject* parsed;
+        Json_reset_mempool();
+        snprintf(input, sizeof(input), templates[i], key);
+        assert(parse_JsonObject(input, &parsed));
+        size_t length = dump_JsonObject(parsed, serial);
+        assert(length > 300);
+        for (int j = 0; j < 5; j++)
+        {
+            memset(parallel, 'X', sizeof(parallel));
+            assert(dump_JsonObject_parallel(parsed, parallel, threads[j]) == length);
+            assert(strcmp(serial, parallel) == 0);
+        }
+    }
+}
+
+void test_parallel_parse()
+{
+    printf("\nTESTING PARALLEL PARSE\n");
+    char* inputs[] = {
+        "{}",
+        "{\"only\": 1}",
+        " {\"a\": 1, \"ab\": [true, null], \"abc\": {\"x\": \"y\"}, \"b\": \"s\", \"a\": 3, \"\": -3, \"ab\": 2.5} ",
+        "{\"rows\": [{\"id\": 1, \"name\": \"ab\"}, {\"id\": 2, \"name\": \"cd\"}, {\"id\": 3}, \"s\", [], 4]}",
+        "{\"k\\u00e9y\": {\"x\": 1, \"y\": [\"a\", \"b\"], \"z\": {}, \"x\": null}}",
+        "{\"rows\": [1, 2, 3], \"count\": 3}",
+        // Long keys take more room than slices get at first, so they are parsed again.
+        "{\"abcdefghij\": 1, \"klmnopqrst\": 2, \"uvwxyzabcd\": 3, \"efghijklmn\": 4}",
+        // Integers too large for a compact slot are boxed in the slice's region.
+        "{\"k0\": 9000000000000000, \"k1\": -9000000000000001, \"k2\": [9000000000000002, 1], \"k3\": 9000000000000003}",
+    };
+    char serial[1024];
+    char parallel[1024];
+    int threads[] = { 1, 2, 3, 7, 100 };
+    for (int i = 0; i < 8; i++)
+    {
+        JsonObject* parsed;
+        assert(parse_JsonObject(inputs[i], &parsed));
+        dump_JsonObject(parsed, serial);
+        printf("%s\n", serial);
+        for (int j = 0; j < 5; j++)
+        {
+            JsonParseError error;
+            Json_reset_mempool();
+            assert(parse_JsonObject_parallel(inputs[i], &parsed, &error, threads[j]));
+            assert(error.code == JSON_PARSE_OK);
+            dump_JsonObject(parsed, parallel);
+            assert(strcmp(serial, parallel) == 0);
+        }
+    }
+
+    // Errors are the same as parsing in one piece, wherever they are.
+    char* invalid[] = {
+        "{\"a\": 1, \"b\": tru}",
+        "{\"a\": 12x, \"b\": 2}",
+        "{\"a\": {\"x\": 1], \"b\": 2}",
+        "{\"a\": [1, 2]} x",
+        "{\"a\": [1, \"\\q\"]}",
+        "{\"a\": 1, \"b\": 2,}",
+        "{\"a\": [1, 2,], \"b\": 01}",
+    };
+    for (int i = 0; i < 7; i++)
+    {
+        JsonObject* parsed;
+        JsonParseError expected, error;
+        assert(!parse_JsonObject_with_error(invalid[i], &parsed, &expected));
+        assert(!parse_JsonObject_parallel(invalid[i], &parsed, &error, 4));
+        assert(!parsed);
+        assert(error.code == expected.code && error.offset == expected.offset);
+    }
+}
+
+void test_mempool_marks()
+{
+    printf("\nTESTING MEMPOOL MARKS\n");
+    JsonObject* base;
+    assert(parse_JsonObject("{\"config\": {\"name\": \"a long enough string\", \"limits\": [1, 2]}}", &base));
+    char before[256];
+    dump_JsonObject(base, before);
+
+    // Temporary documents come and go without touching the base document.
+    JsonMempoolStats stats;
+    JsonMempoolMark mark = Json_mempool_mark();
+    for (int i = 0; i < 3; i++)
+    {
+        JsonObject* request;
+        assert(parse_JsonObject("{\"id\": 7, \"path\": \"/some/long/request/path\", \"args\": [true, null]}", &request));
+        JsonObject* scratch = create_JsonObject();
+        assert(set_value_object(scratch, "request", request));
+        assert(get_value(get_value(scratch, "request").data.o, "id").data.i == 7);
+        Json_get_mempool_stats(&stats);
+        assert(stats.used > mark.used);
+        assert(Json_mempool_release(mark));
+        Json_get_mempool_stats(&stats);
+        assert(stats.used == mark.used);
+    }
+
+    char after[256];
+    dump_JsonObject(base, after);
+    assert(strcmp(before, after) == 0);
+    printf("%s\n", after);
+
+    // Marks nest, and an inner mark is gone once an outer one is released.
+    JsonMempoolMark outer = Json_mempool_mark();
+    create_JsonObject();
+    JsonMempoolMark inner = Json_mempool_mark();
+    create_JsonObject();
+    assert(Json_mempool_release(outer));
+    assert(!Json_mempool_release(inner));
+    assert(Json_mempool_release(outer));
+
+    // Marks only apply to the mempool they were made in.
+    char otherMemory[64];
+    JsonMempool other;
+    JsonMempool* previous = Json_get_mempool();
+    Json_init_mempool(&other, otherMemory, sizeof(otherMemory));
+    Json_use_mempool(&other);
+    assert(!Json_mempool_release(mark));
+    Json_use_mempool(previous);
+    assert(Json_mempool_release(mark));
+}
+
+#ifdef JSON_PROFILE
+void test_profile()
+{
+    printf("\nTESTING PROFILE\n");
+    Json_reset_profile();
+    JsonObject* parsed;
+    parse_JsonObject("{\"a\": [1, 2.5, \"x\\ny\"], \"b\": {\"c\": -3}}", &parsed);
+
+    JsonProfile profile;
+    Json_get_profile(&profile);
+    assert(profile.parses == 1);
+    assert(profile.numbers == 3);
+    assert(profile.escapes == 1);
+    assert(profile.whitespace_bytes == 6);
+    assert(profile.dispatches[0] == 2);                         // Both objects start once
+    assert(strcmp(Json_parse_state_name(8), "number") == 0);
+    assert(profile.peak_depth[1] == 2);                         // Root object and array or inner object
+}
+#endif
 
 int main()
 {
     time_t start = time(NULL);
-    // Statically allocate 1024kb.
-    #define MEMPOOL_SIZE 1024
+    // Statically allocate 4kB.
+    #define MEMPOOL_SIZE 4096
     char mempool[MEMPOOL_SIZE];
 
     Json_set_mempool(mempool, MEMPOOL_SIZE);
@@ -318,15 +1692,84 @@ int main()
     Json_reset_mempool();
     test_arrays();
 
+    Json_reset_mempool();
+    test_element_bounds();
+
     Json_reset_mempool();
     test_nesting();
 
     Json_reset_mempool();
     test_printing();
 
+    Json_reset_mempool();
+    test_printing_key_prefixes();
+
     Json_reset_mempool();
     test_parsing();
 
+    Json_reset_mempool();
+    test_scanners();
+
+    Json_reset_mempool();
+    test_mempool_stats();
+
+    Json_reset_mempool();
+    test_iterator();
+
+    Json_reset_mempool();
+    test_clone();
+
+    Json_reset_mempool();
+    test_patch();
+
+    Json_reset_mempool();
+    test_merge_patch();
+
+    Json_reset_mempool();
+    test_hash_equal();
+
+    Json_reset_mempool();
+    test_freeze();
+
+    Json_reset_mempool();
+    test_parse_errors();
+
+    Json_reset_mempool();
+    test_validate();
+
+    Json_reset_mempool();
+    test_projection();
+
+    Json_reset_mempool();
+    test_events();
+    Json_reset_mempool();
+    test_unicode();
+    Json_reset_mempool();
+    test_escaping();
+    Json_reset_mempool();
+    test_numbers();
+    Json_reset_mempool();
+    test_inline_strings();
+    Json_reset_mempool();
+    test_compact_values();
+    Json_reset_mempool();
+    test_shapes();
+    Json_reset_mempool();
+    test_columns();
+    Json_reset_mempool();
+    test_files();
+    Json_reset_mempool();
+    test_parallel_dump();
+    Json_reset_mempool();
+    test_parallel_parse();
+    Json_reset_mempool();
+    test_mempool_marks();
+
+    #ifdef JSON_PROFILE
+    Json_reset_mempool();
+    test_profile();
+    #endif
+
     time_t end = time(NULL);
     printf("Elapsed %f\n", (double)difftime(end, start));
     